@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2023 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/sys/util.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#include <zmk/event_manager.h>
+
+#if IS_ENABLED(CONFIG_ARCH_POSIX)
+// native_posix time is simulated and doesn't advance while code runs, so measure host CPU time.
+#include <stdlib.h>
+#include <time.h>
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+#else
+static uint64_t now_ns() { return k_cyc_to_ns_floor64(k_cycle_get_32()); }
+#endif
+
+struct benchmark_event {
+    uint32_t value;
+};
+
+ZMK_EVENT_DECLARE(benchmark_event);
+ZMK_EVENT_IMPL(benchmark_event);
+
+struct benchmark_other_event {
+    uint32_t value;
+};
+
+ZMK_EVENT_DECLARE(benchmark_other_event);
+ZMK_EVENT_IMPL(benchmark_other_event);
+
+static int benchmark_listener(const zmk_event_t *eh) { return ZMK_EV_EVENT_BUBBLE; }
+
+#define SUBSCRIBER(n, _)                                                                           \
+    ZMK_LISTENER(benchmark_##n, benchmark_listener)                                                \
+    ZMK_SUBSCRIPTION(benchmark_##n, benchmark_event)
+
+#define OTHER_SUBSCRIBER(n, _)                                                                     \
+    ZMK_LISTENER(benchmark_other_##n, benchmark_listener)                                          \
+    ZMK_SUBSCRIPTION(benchmark_other_##n, benchmark_other_event)
+
+// The event manager indexes subscriptions with a uint8_t.
+BUILD_ASSERT(CONFIG_ZMK_BENCHMARK_SUBSCRIPTIONS + CONFIG_ZMK_BENCHMARK_OTHER_SUBSCRIPTIONS <
+                 UINT8_MAX,
+             "Too many benchmark subscriptions for the event manager");
+
+// The unrelated subscriptions all end up in the subscription section ahead of the benchmarked ones,
+// not interleaved with them, since LISTIFY can't be nested to spread them out. A linear scan of the
+// section has to step over every one of them before reaching the first benchmarked subscription.
+LISTIFY(CONFIG_ZMK_BENCHMARK_OTHER_SUBSCRIPTIONS, OTHER_SUBSCRIBER, ())
+LISTIFY(CONFIG_ZMK_BENCHMARK_SUBSCRIPTIONS, SUBSCRIBER, ())
+
+void main(void) {
+    const int iterations = CONFIG_ZMK_BENCHMARK_ITERATIONS;
+
+    // Allocating and freeing the events is measured separately, so it can be subtracted from the
+    // cost of raising them.
+    uint64_t start = now_ns();
+    for (int i = 0; i < iterations; i++) {
+        ZMK_EVENT_FREE(new_benchmark_event((struct benchmark_event){.value = i}));
+    }
+    uint64_t alloc_ns = now_ns() - start;
+
+    start = now_ns();
+    for (int i = 0; i < iterations; i++) {
+        ZMK_EVENT_RAISE(new_benchmark_event((struct benchmark_event){.value = i}));
+    }
+    uint64_t raise_ns = now_ns() - start;
+
+    uint64_t dispatch_ns = raise_ns > alloc_ns ? raise_ns - alloc_ns : 0;
+
+    printk("subscriptions: %d to event, %d to other events\n", CONFIG_ZMK_BENCHMARK_SUBSCRIPTIONS,
+           CONFIG_ZMK_BENCHMARK_OTHER_SUBSCRIPTIONS);
+    printk("dispatch: %u ns/event (alloc/free: %u ns/event)\n",
+           (uint32_t)(dispatch_ns / iterations), (uint32_t)(alloc_ns / iterations));
+
+#if IS_ENABLED(CONFIG_ARCH_POSIX)
+    exit(0);
+#endif
+}
@@ -0,0 +1,127 @@
+# Copyright (c) 2023 The ZMK Contributors
+# SPDX-License-Identifier: MIT
+"""Generate a synthetic typing stream for the pipeline benchmark's mock kscan."""
+
+import argparse
+import random
+import sys
+
+COLUMNS = 10
+
+# Must match native_posix_64.keymap
+PLAIN_ROWS = [0, 1, 3]
+HOLD_TAP_ROW = 2
+COMBO_ROWS = [0, 1]
+
+TAPPING_TERM_MS = 200
+COMBO_KEY_INTERVAL_MS = 5
+MAX_DELAY_MS = 0x7FFF
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument(
+        "--presses", type=int, default=2000, help="number of key presses"
+    )
+    parser.add_argument(
+        "--keys-per-sec",
+        type=float,
+        default=8,
+        help="typing speed in presses per second",
+    )
+    parser.add_argument(
+        "--rollover",
+        type=float,
+        default=0.3,
+        help="fraction of keys released only after the next key is pressed",
+    )
+    parser.add_argument(
+        "--hold-taps",
+        type=float,
+        default=0.2,
+        help="fraction of presses on hold-tap keys",
+    )
+    parser.add_argument(
+        "--holds",
+        type=float,
+        default=0.25,
+        help="fraction of hold-tap presses held past the tapping term",
+    )
+    parser.add_argument(
+        "--combos", type=float, default=0.1, help="fraction of presses which are combos"
+    )
+    parser.add_argument("--seed", type=int, default=0, help="random seed")
+    return parser.parse_args()
+
+
+def generate(args):
+    rng = random.Random(args.seed)
+    interval = 1000 / args.keys_per_sec
+    held_until = {}
+    events = []
+
+    def free_position(candidates, time):
+        free = [p for p in candidates if held_until.get(p, -1) < time]
+        return rng.choice(free) if free else None
+
+    for i in range(args.presses):
+        press_at = round(i * interval)
+        roll = rng.random() < args.rollover
+        release_at = press_at + round(interval * (1.5 if roll else 0.5))
+        kind = rng.random()
+
+        if kind < args.combos:
+            first = free_position(
+                [
+                    (row, column)
+                    for row in COMBO_ROWS
+                    for column in range(0, COLUMNS, 2)
+                    if held_until.get((row, column + 1), -1) < press_at
+                ],
+                press_at,
+            )
+            if first is not None:
+                second = (first[0], first[1] + 1)
+                for offset, position in enumerate([first, second]):
+                    delay = offset * COMBO_KEY_INTERVAL_MS
+                    events.append((press_at + delay, position, True))
+                    events.append((release_at + delay, position, False))
+                    held_until[position] = release_at + delay
+                continue
+
+        if kind < args.combos + args.hold_taps:
+            position = free_position(
+                [(HOLD_TAP_ROW, column) for column in range(COLUMNS)], press_at
+            )
+            if position is not None and rng.random() < args.holds:
+                release_at = press_at + TAPPING_TERM_MS + round(interval)
+        else:
+            position = free_position(
+                [(row, column) for row in PLAIN_ROWS for column in range(COLUMNS)],
+                press_at,
+            )
+
+        if position is not None:
+            events.append((press_at, position, True))
+            events.append((release_at, position, False))
+            held_until[position] = release_at
+
+    # Releases sort before presses at the same time, so a key is never pressed twice.
+    events.sort(key=lambda event: (event[0], event[2]))
+    return events
+
+
+def write_events(events, out):
+    out.write(f"/* Generated by generate-events.py {' '.join(sys.argv[1:])} */\n")
+    out.write("&kscan {\n    events = <\n")
+    for i, (time, (row, column), pressed) in enumerate(events):
+        # The mock kscan waits this long after the event before replaying the next one.
+        next_time = events[i + 1][0] if i + 1 < len(events) else time
+        delay = min(next_time - time, MAX_DELAY_MS)
+        macro = "ZMK_MOCK_PRESS" if pressed else "ZMK_MOCK_RELEASE"
+        out.write(f"        {macro}({row},{column},{delay})\n")
+    out.write("    >;\n};\n")
+
+
+if __name__ == "__main__":
+    write_events(generate(parse_args()), sys.stdout)
@@ -6,11 +6,15 @@
 
 #pragma once
 
+#include <zephyr/device.h>
+
 #define ZMK_BEHAVIOR_OPAQUE 0
 #define ZMK_BEHAVIOR_TRANSPARENT 1
 
 struct zmk_behavior_binding {
     char *behavior_dev;
+    // Resolved device for behavior_dev. When NULL, the device is looked up by name on use.
+    const struct device *behavior;
     uint32_t param1;
     uint32_t param2;
 };
@@ -19,4 +23,22 @@ struct zmk_behavior_binding_event {
     int layer;
     uint32_t position;
     int64_t timestamp;
-};
\ No newline at end of file
+};
+/**
+ * @brief Get the behavior device for a binding.
+ *
+ * Uses the pre-resolved device pointer if the binding has one, otherwise falls back to looking up
+ * the device by its name.
+ *
+ * @param binding The binding to get the behavior device for.
+ *
+ * @retval Pointer to the behavior device, or NULL if no device could be found.
+ */
+static inline const struct device *
+zmk_behavior_get_binding_device(const struct zmk_behavior_binding *binding) {
+    if (binding->behavior != NULL) {
+        return binding->behavior;
+    }
+
+    return device_get_binding(binding->behavior_dev);
+}
@@ -10,5 +10,44 @@
 #include <stdint.h>
 #include <zmk/behavior.h>
 
+struct zmk_behavior_queue_stats {
+    // Steps currently waiting in every timeline.
+    uint32_t depth;
+    // Most steps which have been waiting in a single timeline at once.
+    uint32_t high_water;
+    // Taps which were merged into a tap already waiting in the queue.
+    uint32_t coalesced_taps;
+    // Steps which didn't fit in their timeline.
+    uint32_t dropped;
+};
+
+/**
+ * @brief Queue a press or release of a behavior.
+ *
+ * Behaviors are queued on one of several independent timelines, picked by position, so that a
+ * slow sequence from one position does not hold up behaviors queued from another.
+ *
+ * @param wait Time to wait, in milliseconds, before invoking the next behavior on the timeline.
+ *
+ * @retval 0 If successful.
+ * @retval -ENOMEM If the timeline is full.
+ */
 int zmk_behavior_queue_add(uint32_t position, const struct zmk_behavior_binding behavior,
                            bool press, uint32_t wait);
+
+/**
+ * @brief Queue a number of taps of a behavior.
+ *
+ * If the last step waiting on the timeline is a tap of the same behavior with the same timing,
+ * the taps are added to it instead of using more of the queue.
+ *
+ * @param tap_ms Time to wait, in milliseconds, between the press and release of each tap.
+ * @param wait Time to wait, in milliseconds, after the release of each tap.
+ *
+ * @retval 0 If successful.
+ * @retval -ENOMEM If the timeline is full.
+ */
+int zmk_behavior_queue_add_taps(uint32_t position, const struct zmk_behavior_binding behavior,
+                                uint16_t count, uint32_t tap_ms, uint32_t wait);
+
+void zmk_behavior_queue_get_stats(struct zmk_behavior_queue_stats *stats);
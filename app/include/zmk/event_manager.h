@@ -10,8 +10,48 @@
 #include <zephyr/kernel.h>
 #include <zephyr/types.h>
 
+#if IS_ENABLED(CONFIG_ZMK_EVENT_POOL)
+
+struct zmk_event_pool {
+    struct k_mem_slab *slab;
+    // The largest number of events of this type that have been allocated at the same time.
+    uint32_t high_water_mark;
+    // The number of allocations that could not be served from the pool.
+    uint32_t exhausted_count;
+};
+
+#define ZMK_EVENT_POOL_DEFINE(event_type)                                                          \
+    K_MEM_SLAB_DEFINE_STATIC(zmk_event_slab_##event_type, sizeof(struct event_type##_event),       \
+                             CONFIG_ZMK_EVENT_POOL_SIZE, __alignof__(struct event_type##_event));  \
+    static struct zmk_event_pool zmk_event_pool_##event_type = {                                   \
+        .slab = &zmk_event_slab_##event_type,                                                      \
+    };
+
+#define ZMK_EVENT_POOL_REF(event_type) .pool = &zmk_event_pool_##event_type,
+
+#else
+
+#define ZMK_EVENT_POOL_DEFINE(event_type)
+#define ZMK_EVENT_POOL_REF(event_type)
+
+#endif /* IS_ENABLED(CONFIG_ZMK_EVENT_POOL) */
+
+// The subscriptions to an event type, as a contiguous range of the subscription table that the
+// event manager builds at boot, ordered the same as the `.event_subscription` section.
+struct zmk_event_subscribers {
+    uint8_t start;
+    uint8_t len;
+    // The index of each listener within the range, by listener ordinal, or UINT8_MAX if the
+    // listener isn't subscribed to the event type.
+    uint8_t *listener_indexes;
+};
+
 struct zmk_event_type {
     const char *name;
+    struct zmk_event_subscribers *subscribers;
+#if IS_ENABLED(CONFIG_ZMK_EVENT_POOL)
+    struct zmk_event_pool *pool;
+#endif
 };
 
 typedef struct {
@@ -26,6 +66,9 @@ typedef struct {
 typedef int (*zmk_listener_callback_t)(const zmk_event_t *eh);
 struct zmk_listener {
     zmk_listener_callback_t callback;
+    // Assigned by the event manager at boot, to look up where the listener is in the listeners of
+    // an event type.
+    uint8_t *ordinal;
 };
 
 struct zmk_event_subscription {
@@ -43,12 +86,20 @@ struct zmk_event_subscription {
     extern const struct zmk_event_type zmk_event_##event_type;
 
 #define ZMK_EVENT_IMPL(event_type)                                                                 \
-    const struct zmk_event_type zmk_event_##event_type = {.name = STRINGIFY(event_type)};          \
+    ZMK_EVENT_POOL_DEFINE(event_type)                                                              \
+    static struct zmk_event_subscribers zmk_event_subscribers_##event_type;                        \
+    const struct zmk_event_type zmk_event_##event_type = {                                         \
+        .name = STRINGIFY(event_type),                                                             \
+        .subscribers = &zmk_event_subscribers_##event_type,                                        \
+        ZMK_EVENT_POOL_REF(event_type)};                                                           \
     const struct zmk_event_type *zmk_event_ref_##event_type __used                                 \
         __attribute__((__section__(".event_type"))) = &zmk_event_##event_type;                     \
     struct event_type##_event *new_##event_type(struct event_type data) {                          \
-        struct event_type##_event *ev =                                                            \
-            (struct event_type##_event *)k_malloc(sizeof(struct event_type##_event));              \
+        struct event_type##_event *ev = (struct event_type##_event *)zmk_event_manager_alloc(      \
+            &zmk_event_##event_type, sizeof(struct event_type##_event));                           \
+        if (ev == NULL) {                                                                          \
+            return NULL;                                                                           \
+        }                                                                                          \
         ev->header.event = &zmk_event_##event_type;                                                \
         ev->data = data;                                                                           \
         return ev;                                                                                 \
@@ -58,7 +109,10 @@ struct zmk_event_subscription {
                                                       : NULL;                                      \
     };
 
-#define ZMK_LISTENER(mod, cb) const struct zmk_listener zmk_listener_##mod = {.callback = cb};
+#define ZMK_LISTENER(mod, cb)                                                                      \
+    static uint8_t zmk_listener_ordinal_##mod = UINT8_MAX;                                         \
+    const struct zmk_listener zmk_listener_##mod = {.callback = cb,                                \
+                                                    .ordinal = &zmk_listener_ordinal_##mod};
 
 #define ZMK_SUBSCRIPTION(mod, ev_type)                                                             \
     const Z_DECL_ALIGN(struct zmk_event_subscription)                                              \
@@ -78,7 +132,10 @@ struct zmk_event_subscription {
 
 #define ZMK_EVENT_RELEASE(ev) zmk_event_manager_release((zmk_event_t *)ev);
 
-#define ZMK_EVENT_FREE(ev) k_free((void *)ev);
+#define ZMK_EVENT_FREE(ev) zmk_event_manager_free((zmk_event_t *)ev);
+
+void *zmk_event_manager_alloc(const struct zmk_event_type *event_type, size_t size);
+void zmk_event_manager_free(zmk_event_t *event);
 
 int zmk_event_manager_raise(zmk_event_t *event);
 int zmk_event_manager_raise_after(zmk_event_t *event, const struct zmk_listener *listener);
@@ -6,10 +6,26 @@
 
 #pragma once
 
+#include <zephyr/bluetooth/conn.h>
+
 #include <zmk/keys.h>
 #include <zmk/hid.h>
 
+struct zmk_hog_report_stats {
+    // Reports notified to the host.
+    uint32_t sent;
+    // Queued reports replaced by a later one which didn't undo any of their changes.
+    uint32_t merged;
+    // Reports which arrived while the queue was full, and were folded into the reports queued once
+    // there was room again.
+    uint32_t overflowed;
+    // Reports which were discarded because the notification failed.
+    uint32_t dropped;
+};
+
 int zmk_hog_init();
 
 int zmk_hog_send_keyboard_report(struct zmk_hid_keyboard_report_body *body);
 int zmk_hog_send_consumer_report(struct zmk_hid_consumer_report_body *body);
+
+int zmk_hog_get_report_stats(struct bt_conn *conn, struct zmk_hog_report_stats *stats);
@@ -8,4 +8,15 @@
 
 #include <zephyr/device.h>
 
+struct zmk_kscan_stats {
+    // Key presses dropped because the event queue was full.
+    uint32_t dropped_presses;
+    // Key releases which didn't fit in the event queue, and were raised once it was drained.
+    uint32_t deferred_releases;
+    // Most events which have been waiting in the queue at once.
+    uint32_t high_water;
+};
+
 int zmk_kscan_init(const struct device *dev);
+
+void zmk_kscan_get_stats(struct zmk_kscan_stats *stats);
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2023 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <zephyr/kernel.h>
+
+/**
+ * Stages of processing a key change, from the kscan driver reporting it to the HID report being
+ * sent. The latency of each stage is measured from the time the kscan driver reported the change.
+ */
+enum zmk_latency_stage {
+    ZMK_LATENCY_STAGE_KSCAN_QUEUE,
+    ZMK_LATENCY_STAGE_POSITION_EVENT,
+    ZMK_LATENCY_STAGE_BEHAVIOR,
+    ZMK_LATENCY_STAGE_KEYCODE_EVENT,
+    ZMK_LATENCY_STAGE_REPORT_QUEUED,
+    ZMK_LATENCY_STAGE_REPORT_SENT,
+    ZMK_LATENCY_STAGE_COUNT,
+};
+
+struct zmk_latency_stats {
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t total_us;
+};
+
+#if IS_ENABLED(CONFIG_ZMK_LATENCY_TRACING)
+
+/**
+ * @brief Get a timestamp to start a trace from, in hardware cycles.
+ */
+uint32_t zmk_latency_now();
+
+/**
+ * @brief Start tracing the processing of a key change which happened at the given timestamp.
+ *
+ * Stages recorded until zmk_latency_trace_end() is called are attributed to this key change.
+ */
+void zmk_latency_trace_begin(uint32_t start);
+void zmk_latency_trace_end();
+
+/**
+ * @brief Get the start timestamp of the active trace, or 0 if no trace is active.
+ *
+ * Used to carry a trace over to work which completes asynchronously, such as sending a report.
+ */
+uint32_t zmk_latency_trace_start();
+
+/**
+ * @brief Record that the active trace, if any, reached the given stage.
+ */
+void zmk_latency_record(enum zmk_latency_stage stage);
+
+/**
+ * @brief Record that the trace started at the given timestamp reached the given stage.
+ */
+void zmk_latency_record_from(enum zmk_latency_stage stage, uint32_t start);
+
+int zmk_latency_get_stats(enum zmk_latency_stage stage, struct zmk_latency_stats *stats);
+uint32_t zmk_latency_get_percentile_us(enum zmk_latency_stage stage, uint8_t percentile);
+void zmk_latency_reset();
+
+/**
+ * @brief Check the latency of sending HID reports against CONFIG_ZMK_LATENCY_TRACING_BUDGET_US.
+ *
+ * @retval 0 if the p99 latency is within budget, or there is no budget.
+ * @retval -ENODATA if no reports have been traced yet.
+ * @retval -ETIME if the p99 latency exceeds the budget.
+ */
+int zmk_latency_check_budget();
+
+#else
+
+static inline uint32_t zmk_latency_now() { return 0; }
+static inline void zmk_latency_trace_begin(uint32_t start) {}
+static inline void zmk_latency_trace_end() {}
+static inline uint32_t zmk_latency_trace_start() { return 0; }
+static inline void zmk_latency_record(enum zmk_latency_stage stage) {}
+static inline void zmk_latency_record_from(enum zmk_latency_stage stage, uint32_t start) {}
+
+#endif /* IS_ENABLED(CONFIG_ZMK_LATENCY_TRACING) */
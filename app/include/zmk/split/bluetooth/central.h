@@ -4,5 +4,33 @@
 #include <zephyr/bluetooth/addr.h>
 #include <zmk/behavior.h>
 
+struct zmk_split_peripheral_stats {
+    // Position events received from the peripheral.
+    uint32_t position_events;
+    // Position events dropped because the central's event queue was full.
+    uint32_t position_events_dropped;
+    uint32_t behaviors_sent;
+    // Behaviors dropped because the peripheral's queue was full or the write failed.
+    uint32_t behaviors_dropped;
+    uint32_t behavior_queue_depth;
+    uint32_t behavior_queue_high_water;
+    // How much longer than the fastest notification the last one took to arrive. Only measured
+    // when the peripheral sends position changes.
+    uint32_t link_delay_ms;
+    uint32_t max_link_delay_ms;
+};
+
 int zmk_split_bt_invoke_behavior(uint8_t source, struct zmk_behavior_binding *binding,
-                                 struct zmk_behavior_binding_event event, bool state);
\ No newline at end of file
+                                 struct zmk_behavior_binding_event event, bool state);
+
+/**
+ * @brief Invoke a behavior on every connected peripheral.
+ */
+int zmk_split_bt_invoke_behavior_all(struct zmk_behavior_binding *binding,
+                                     struct zmk_behavior_binding_event event, bool state);
+
+/**
+ * @brief Get the link statistics of a peripheral since it last connected.
+ */
+int zmk_split_bt_central_get_peripheral_stats(uint8_t source,
+                                              struct zmk_split_peripheral_stats *stats);
@@ -6,11 +6,16 @@
 
 #pragma once
 
+#include <zmk/behavior.h>
 #include <zmk/events/sensor_event.h>
+#include <zmk/matrix.h>
 #include <zmk/sensors.h>
 
 #define ZMK_SPLIT_RUN_BEHAVIOR_DEV_LEN 9
 
+// Large enough for every key position, but never smaller than the 16 bytes older halves expect.
+#define ZMK_SPLIT_POS_STATE_LEN MAX(16, DIV_ROUND_UP(ZMK_KEYMAP_LEN, 8))
+
 struct sensor_event {
     uint8_t sensor_index;
 
@@ -30,8 +35,62 @@ struct zmk_split_run_behavior_payload {
     char behavior_dev[ZMK_SPLIT_RUN_BEHAVIOR_DEV_LEN];
 } __packed;
 
-int zmk_split_bt_position_pressed(uint8_t position);
-int zmk_split_bt_position_released(uint8_t position);
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_BEHAVIOR_IDS)
+
+#define ZMK_SPLIT_BT_BEHAVIOR_ID_INVALID UINT8_MAX
+
+/**
+ * Invokes a behavior by its index in the behavior ID table shared by both halves. This always fits
+ * in a single write, and needs no lookup by name on the peripheral.
+ */
+struct zmk_split_run_behavior_id_payload {
+    uint8_t behavior_id;
+    struct zmk_split_run_behavior_data data;
+} __packed;
+
+/**
+ * @brief Get a hash of the behavior ID table. Behavior IDs are only valid to use with a peer whose
+ * table has the same hash.
+ */
+uint32_t zmk_split_bt_behavior_table_hash();
+
+/**
+ * @brief Get the behavior ID of a binding's behavior, or ZMK_SPLIT_BT_BEHAVIOR_ID_INVALID if it
+ * does not have one.
+ */
+uint8_t zmk_split_bt_behavior_id(const struct zmk_behavior_binding *binding);
+
+/**
+ * @brief Get the behavior device with the given ID, or NULL if there is none.
+ */
+const struct device *zmk_split_bt_behavior_by_id(uint8_t id);
+
+#endif /* IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_BEHAVIOR_IDS) */
+
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_POSITION_CHANGES)
+
+/**
+ * Header of a position changes notification. It is followed by one zmk_split_position_change for
+ * each key which changed, oldest first.
+ */
+struct zmk_split_position_changes_header {
+    // Peripheral uptime in milliseconds of the newest change, truncated to 32 bits.
+    uint32_t timestamp;
+} __packed;
+
+#define ZMK_SPLIT_POSITION_CHANGE_PRESSED BIT(15)
+
+struct zmk_split_position_change {
+    // Key position, with ZMK_SPLIT_POSITION_CHANGE_PRESSED set if the key was pressed.
+    uint16_t position;
+    // Milliseconds between the change and the header timestamp.
+    uint16_t age;
+} __packed;
+
+#endif /* IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_POSITION_CHANGES) */
+
+int zmk_split_bt_position_pressed(uint32_t position, int64_t timestamp);
+int zmk_split_bt_position_released(uint32_t position, int64_t timestamp);
 int zmk_split_bt_sensor_triggered(uint8_t sensor_index,
                                   const struct zmk_sensor_channel_data channel_data[],
                                   size_t channel_data_size);
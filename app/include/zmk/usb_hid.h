@@ -6,4 +6,23 @@
 
 #pragma once
 
-int zmk_usb_hid_send_report(const uint8_t *report, size_t len);
\ No newline at end of file
+#include <stddef.h>
+#include <stdint.h>
+
+struct zmk_usb_hid_stats {
+    // Reports the host has read from the endpoint.
+    uint32_t sent;
+    // Reports superseded by a newer one because the queue for their report ID was full.
+    uint32_t overflows;
+    // Times the host didn't read a report within the stall timeout, and it was written again.
+    uint32_t stalls;
+    // Writes to the endpoint which failed, after which the report was written again.
+    uint32_t errors;
+};
+
+/**
+ * @brief Queue a report to send to the host. Never waits for the endpoint to be free.
+ */
+int zmk_usb_hid_send_report(const uint8_t *report, size_t len);
+
+void zmk_usb_hid_get_stats(struct zmk_usb_hid_stats *stats);
@@ -41,6 +41,8 @@ struct reg_595_drv_data {
     struct k_sem lock;
 
     uint32_t gpio_cache;
+    /* Whether gpio_cache matches the registers, so writes which change nothing can be skipped */
+    bool cache_valid;
 };
 
 static int reg_595_write_registers(const struct device *dev, uint32_t value) {
@@ -69,6 +71,7 @@ static int reg_595_write_registers(const struct device *dev, uint32_t value) {
     }
 
     drv_data->gpio_cache = value;
+    drv_data->cache_valid = true;
     return 0;
 }
 
@@ -126,6 +129,12 @@ static int reg_595_port_set_masked_raw(const struct device *dev, uint32_t mask,
     buf = drv_data->gpio_cache;
     buf = (buf & ~mask) | (mask & value);
 
+    /* Scanning a matrix sets pins which are already set, so skip the SPI transfer */
+    if (drv_data->cache_valid && buf == drv_data->gpio_cache) {
+        k_sem_give(&drv_data->lock);
+        return 0;
+    }
+
     ret = reg_595_write_registers(dev, buf);
 
     k_sem_give(&drv_data->lock);
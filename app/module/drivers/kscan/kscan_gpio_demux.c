@@ -19,22 +19,14 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 // Define row and col cfg
 #define _KSCAN_GPIO_CFG_INIT(n, prop, idx) GPIO_DT_SPEC_GET_BY_IDX(n, prop, idx),
 
-// Check debounce config
-#define CHECK_DEBOUNCE_CFG(n, a, b) COND_CODE_0(DT_INST_PROP(n, debounce_period), a, b)
-
 // Define the row and column lengths
 #define INST_MATRIX_INPUTS(n) DT_INST_PROP_LEN(n, input_gpios)
 #define INST_DEMUX_GPIOS(n) DT_INST_PROP_LEN(n, output_gpios)
 #define INST_MATRIX_OUTPUTS(n) PWR_TWO(INST_DEMUX_GPIOS(n))
 #define POLL_INTERVAL(n) DT_INST_PROP(n, polling_interval_msec)
+#define ACTIVE_SCAN_INTERVAL(n) MAX(DT_INST_PROP(n, debounce_period), 1)
 
 #define GPIO_INST_INIT(n)                                                                          \
-    struct kscan_gpio_irq_callback_##n {                                                           \
-        struct CHECK_DEBOUNCE_CFG(n, (k_work), (k_work_delayable)) * work;                         \
-        struct gpio_callback callback;                                                             \
-        const struct device *dev;                                                                  \
-    };                                                                                             \
-                                                                                                   \
     struct kscan_gpio_config_##n {                                                                 \
         const struct gpio_dt_spec rows[INST_MATRIX_INPUTS(n)];                                     \
         const struct gpio_dt_spec cols[INST_DEMUX_GPIOS(n)];                                       \
@@ -42,8 +34,11 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
                                                                                                    \
     struct kscan_gpio_data_##n {                                                                   \
         kscan_callback_t callback;                                                                 \
-        struct k_timer poll_timer;                                                                 \
-        struct CHECK_DEBOUNCE_CFG(n, (k_work), (k_work_delayable)) work;                           \
+        struct k_work_delayable work;                                                              \
+        /* Timestamp of the current or scheduled scan */                                           \
+        int64_t scan_time;                                                                         \
+        /* Output currently selected by the demux address GPIOs */                                 \
+        int selected;                                                                              \
         bool matrix_state[INST_MATRIX_INPUTS(n)][INST_MATRIX_OUTPUTS(n)];                          \
         const struct device *dev;                                                                  \
     };                                                                                             \
@@ -57,11 +52,17 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
         const struct kscan_gpio_config_##n *cfg = dev->config;                                     \
         return cfg->cols;                                                                          \
     }                                                                                              \
-    /* POLLING SETUP */                                                                            \
-    static void kscan_gpio_timer_handler(struct k_timer *timer) {                                  \
-        struct kscan_gpio_data_##n *data =                                                         \
-            CONTAINER_OF(timer, struct kscan_gpio_data_##n, poll_timer);                           \
-        k_work_submit(&data->work.work);                                                           \
+    /* Set only the address GPIOs which differ from the current output */                          \
+    static void kscan_gpio_select_##n(const struct device *dev, const int output) {                \
+        struct kscan_gpio_data_##n *data = dev->data;                                              \
+        const int changed = data->selected ^ output;                                               \
+        for (uint8_t bit = 0; bit < INST_DEMUX_GPIOS(n); bit++) {                                  \
+            if (changed & BIT(bit)) {                                                              \
+                const struct gpio_dt_spec *out_spec = &kscan_gpio_output_specs_##n(dev)[bit];      \
+                gpio_pin_set_dt(out_spec, (output & BIT(bit)) != 0);                               \
+            }                                                                                      \
+        }                                                                                          \
+        data->selected = output;                                                                   \
     }                                                                                              \
                                                                                                    \
     /* Read the state of the input GPIOs */                                                        \
@@ -70,13 +71,11 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
         bool submit_follow_up_read = false;                                                        \
         struct kscan_gpio_data_##n *data = dev->data;                                              \
         static bool read_state[INST_MATRIX_INPUTS(n)][INST_MATRIX_OUTPUTS(n)];                     \
-        for (int o = 0; o < INST_MATRIX_OUTPUTS(n); o++) {                                         \
-            /* Iterate over bits and set GPIOs accordingly */                                      \
-            for (uint8_t bit = 0; bit < INST_DEMUX_GPIOS(n); bit++) {                              \
-                uint8_t state = (o & (0b1 << bit)) >> bit;                                         \
-                const struct gpio_dt_spec *out_spec = &kscan_gpio_output_specs_##n(dev)[bit];      \
-                gpio_pin_set_dt(out_spec, state);                                                  \
-            }                                                                                      \
+        for (int step = 0; step < INST_MATRIX_OUTPUTS(n); step++) {                                \
+            /* Visit the outputs in Gray code order, so each one changes only one address GPIO. */ \
+            /* This matters most when the address GPIOs are on an SPI shift register. */           \
+            const int o = step ^ (step >> 1);                                                      \
+            kscan_gpio_select_##n(dev, o);                                                         \
             /* Let the col settle before reading the rows */                                       \
             k_usleep(1);                                                                           \
                                                                                                    \
@@ -97,15 +96,16 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
                 }                                                                                  \
             }                                                                                      \
         }                                                                                          \
-        if (submit_follow_up_read) {                                                               \
-            CHECK_DEBOUNCE_CFG(n, ({ k_work_submit(&data->work); }),                               \
-                               ({ k_work_reschedule(&data->work, K_MSEC(5)); }))                   \
-        }                                                                                          \
+        /* Scan again quickly while any key is pressed, and go back to polling slowly once */      \
+        /* everything is released. */                                                              \
+        data->scan_time += submit_follow_up_read ? ACTIVE_SCAN_INTERVAL(n) : POLL_INTERVAL(n);     \
+        k_work_reschedule(&data->work, K_TIMEOUT_ABS_MS(data->scan_time));                         \
         return 0;                                                                                  \
     }                                                                                              \
                                                                                                    \
     static void kscan_gpio_work_handler_##n(struct k_work *work) {                                 \
-        struct kscan_gpio_data_##n *data = CONTAINER_OF(work, struct kscan_gpio_data_##n, work);   \
+        struct k_work_delayable *dwork = CONTAINER_OF(work, struct k_work_delayable, work);        \
+        struct kscan_gpio_data_##n *data = CONTAINER_OF(dwork, struct kscan_gpio_data_##n, work);  \
         kscan_gpio_read_##n(data->dev);                                                            \
     }                                                                                              \
                                                                                                    \
@@ -127,17 +127,15 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
     static int kscan_gpio_enable_##n(const struct device *dev) {                                   \
         LOG_DBG("KSCAN API enable");                                                               \
         struct kscan_gpio_data_##n *data = dev->data;                                              \
-        /* TODO: we might want a follow up to hook into the sleep state hooks in Zephyr, */        \
-        /* and disable this timer when we enter a sleep state */                                   \
-        k_timer_start(&data->poll_timer, K_MSEC(POLL_INTERVAL(n)), K_MSEC(POLL_INTERVAL(n)));      \
-        return 0;                                                                                  \
+        data->scan_time = k_uptime_get();                                                          \
+        return kscan_gpio_read_##n(dev);                                                           \
     };                                                                                             \
                                                                                                    \
     /* KSCAN API disable function */                                                               \
     static int kscan_gpio_disable_##n(const struct device *dev) {                                  \
         LOG_DBG("KSCAN API disable");                                                              \
         struct kscan_gpio_data_##n *data = dev->data;                                              \
-        k_timer_stop(&data->poll_timer);                                                           \
+        k_work_cancel_delayable(&data->work);                                                      \
         return 0;                                                                                  \
     };                                                                                             \
                                                                                                    \
@@ -181,11 +179,10 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
             }                                                                                      \
         }                                                                                          \
         data->dev = dev;                                                                           \
+        /* Every address GPIO starts active */                                                     \
+        data->selected = INST_MATRIX_OUTPUTS(n) - 1;                                               \
                                                                                                    \
-        k_timer_init(&data->poll_timer, kscan_gpio_timer_handler, NULL);                           \
-                                                                                                   \
-        (CHECK_DEBOUNCE_CFG(n, (k_work_init), (k_work_init_delayable)))(                           \
-            &data->work, kscan_gpio_work_handler_##n);                                             \
+        k_work_init_delayable(&data->work, kscan_gpio_work_handler_##n);                           \
         return 0;                                                                                  \
     }                                                                                              \
                                                                                                    \
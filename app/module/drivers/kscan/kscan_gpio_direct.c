@@ -12,6 +12,7 @@
 #include <zephyr/drivers/kscan.h>
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
+#include <zephyr/sys/math_extras.h>
 #include <zephyr/sys/util.h>
 
 #include <zmk/debounce.h>
@@ -34,6 +35,9 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
     DT_INST_PROP_OR(n, debounce_period, DT_INST_PROP(n, debounce_release_ms))
 #endif
 
+#define COND_EAGER(eagercode, defercode)                                                           \
+    COND_CODE_1(CONFIG_ZMK_KSCAN_DEBOUNCE_EAGER, eagercode, defercode)
+
 #define USE_POLLING IS_ENABLED(CONFIG_ZMK_KSCAN_DIRECT_POLLING)
 #define USE_INTERRUPTS (!USE_POLLING)
 
@@ -42,6 +46,7 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
     COND_CODE_1(CONFIG_ZMK_KSCAN_DIRECT_POLLING, pollcode, intcode)
 
 #define INST_INPUTS_LEN(n) DT_INST_PROP_LEN(n, input_gpios)
+#define INST_INPUT_WORDS(n) DIV_ROUND_UP(INST_INPUTS_LEN(n), 32)
 #define KSCAN_DIRECT_INPUT_CFG_INIT(idx, inst_idx)                                                 \
     KSCAN_GPIO_GET_BY_IDX(DT_DRV_INST(inst_idx), input_gpios, idx)
 
@@ -61,8 +66,18 @@ struct kscan_direct_data {
 #endif
     /** Timestamp of the current or scheduled scan. */
     int64_t scan_time;
+#if IS_ENABLED(CONFIG_ZMK_KSCAN_DEBOUNCE_EAGER)
+    /**
+     * Debounce state of the inputs as bitmasks with one bit per input in the order of data->inputs.
+     * Array of length DIV_ROUND_UP(data->inputs.len, 32)
+     */
+    struct zmk_debounce_bitmap *input_state;
+    /** Debounce timers of the inputs in the order of data->inputs. */
+    uint16_t *timers;
+#else
     /** Current state of the inputs as an array of length config->inputs.len */
     struct zmk_debounce_state *pin_state;
+#endif
 };
 
 struct kscan_direct_config {
@@ -167,7 +182,74 @@ static void kscan_direct_read_end(const struct device *dev) {
 #endif
 }
 
-static int kscan_direct_read(const struct device *dev) {
+static void kscan_direct_report(const struct device *dev, const struct kscan_gpio *gpio,
+                                const bool pressed) {
+    struct kscan_direct_data *data = dev->data;
+    const struct kscan_direct_config *config = dev->config;
+
+    LOG_DBG("Sending event at 0,%i state %s", gpio->index, pressed ? "on" : "off");
+    data->callback(dev, 0, gpio->index, pressed);
+    if (config->toggle_mode && pressed) {
+        kscan_inputs_set_flags(&data->inputs, &gpio->spec);
+    }
+}
+
+#if IS_ENABLED(CONFIG_ZMK_KSCAN_DEBOUNCE_EAGER)
+
+/**
+ * Read and debounce the inputs 32 at a time, and report any which changed.
+ *
+ * @returns whether to continue scanning quickly, or a negative error code.
+ */
+static int kscan_direct_update_inputs(const struct device *dev) {
+    struct kscan_direct_data *data = dev->data;
+    const struct kscan_direct_config *config = dev->config;
+
+    struct kscan_gpio_port_state state = {0};
+    bool continue_scan = false;
+
+    for (int first = 0; first < data->inputs.len; first += 32) {
+        const int last = MIN(data->inputs.len, first + 32);
+        uint32_t value = 0;
+
+        for (int i = first; i < last; i++) {
+            const struct kscan_gpio *gpio = &data->inputs.gpios[i];
+
+            const int active = kscan_gpio_pin_get(gpio, &state);
+            if (active < 0) {
+                LOG_ERR("Failed to read port %s: %i", gpio->spec.port->name, active);
+                return active;
+            }
+
+            WRITE_BIT(value, i - first, active);
+        }
+
+        struct zmk_debounce_bitmap *bitmap = &data->input_state[first / 32];
+        uint32_t changed =
+            zmk_debounce_eager_update(bitmap, &data->timers[first], value,
+                                      config->debounce_scan_period_ms, &config->debounce_config);
+
+        while (changed) {
+            const int bit = u32_count_trailing_zeros(changed);
+            changed &= changed - 1;
+
+            kscan_direct_report(dev, &data->inputs.gpios[first + bit], bitmap->pressed & BIT(bit));
+        }
+
+        continue_scan = continue_scan || bitmap->pressed || bitmap->unsettled;
+    }
+
+    return continue_scan;
+}
+
+#else
+
+/**
+ * Read and debounce the inputs, and report any which changed.
+ *
+ * @returns whether to continue scanning quickly, or a negative error code.
+ */
+static int kscan_direct_update_inputs(const struct device *dev) {
     struct kscan_direct_data *data = dev->data;
     const struct kscan_direct_config *config = dev->config;
 
@@ -195,18 +277,23 @@ static int kscan_direct_read(const struct device *dev) {
         struct zmk_debounce_state *state = &data->pin_state[gpio->index];
 
         if (zmk_debounce_get_changed(state)) {
-            const bool pressed = zmk_debounce_is_pressed(state);
-
-            LOG_DBG("Sending event at 0,%i state %s", gpio->index, pressed ? "on" : "off");
-            data->callback(dev, 0, gpio->index, pressed);
-            if (config->toggle_mode && pressed) {
-                kscan_inputs_set_flags(&data->inputs, &gpio->spec);
-            }
+            kscan_direct_report(dev, gpio, zmk_debounce_is_pressed(state));
         }
 
         continue_scan = continue_scan || zmk_debounce_is_active(state);
     }
 
+    return continue_scan;
+}
+
+#endif /* IS_ENABLED(CONFIG_ZMK_KSCAN_DEBOUNCE_EAGER) */
+
+static int kscan_direct_read(const struct device *dev) {
+    const int continue_scan = kscan_direct_update_inputs(dev);
+    if (continue_scan < 0) {
+        return continue_scan;
+    }
+
     if (continue_scan) {
         // At least one key is pressed or the debouncer has not yet decided if
         // it is pressed. Poll quickly until everything is released.
@@ -333,14 +420,19 @@ static const struct kscan_driver_api kscan_direct_api = {
     static struct kscan_gpio kscan_direct_inputs_##n[] = {                                         \
         LISTIFY(INST_INPUTS_LEN(n), KSCAN_DIRECT_INPUT_CFG_INIT, (, ), n)};                        \
                                                                                                    \
-    static struct zmk_debounce_state kscan_direct_state_##n[INST_INPUTS_LEN(n)];                   \
+    COND_EAGER(                                                                                    \
+        (static struct zmk_debounce_bitmap kscan_direct_input_state_##n[INST_INPUT_WORDS(n)];      \
+         static uint16_t kscan_direct_timers_##n[INST_INPUTS_LEN(n)];),                            \
+        (static struct zmk_debounce_state kscan_direct_state_##n[INST_INPUTS_LEN(n)];))            \
                                                                                                    \
     COND_INTERRUPTS(                                                                               \
         (static struct kscan_direct_irq_callback kscan_direct_irqs_##n[INST_INPUTS_LEN(n)];))      \
                                                                                                    \
     static struct kscan_direct_data kscan_direct_data_##n = {                                      \
         .inputs = KSCAN_GPIO_LIST(kscan_direct_inputs_##n),                                        \
-        .pin_state = kscan_direct_state_##n,                                                       \
+        COND_EAGER((.input_state = kscan_direct_input_state_##n,                                   \
+                    .timers = kscan_direct_timers_##n, ),                                          \
+                   (.pin_state = kscan_direct_state_##n, ))                                        \
         COND_INTERRUPTS((.irqs = kscan_direct_irqs_##n, ))};                                       \
                                                                                                    \
     static struct kscan_direct_config kscan_direct_config_##n = {                                  \
@@ -13,6 +13,7 @@
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
 #include <zephyr/sys/__assert.h>
+#include <zephyr/sys/math_extras.h>
 #include <zephyr/sys/util.h>
 
 #include <zmk/debounce.h>
@@ -29,6 +30,8 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 #define INST_COLS_LEN(n) DT_INST_PROP_LEN(n, col_gpios)
 #define INST_MATRIX_LEN(n) (INST_ROWS_LEN(n) * INST_COLS_LEN(n))
 #define INST_INPUTS_LEN(n) COND_DIODE_DIR(n, (INST_COLS_LEN(n)), (INST_ROWS_LEN(n)))
+#define INST_OUTPUTS_LEN(n) COND_DIODE_DIR(n, (INST_ROWS_LEN(n)), (INST_COLS_LEN(n)))
+#define INST_INPUT_WORDS(n) DIV_ROUND_UP(INST_INPUTS_LEN(n), 32)
 
 #if CONFIG_ZMK_KSCAN_DEBOUNCE_PRESS_MS >= 0
 #define INST_DEBOUNCE_PRESS_MS(n) CONFIG_ZMK_KSCAN_DEBOUNCE_PRESS_MS
@@ -44,6 +47,22 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
     DT_INST_PROP_OR(n, debounce_period, DT_INST_PROP(n, debounce_release_ms))
 #endif
 
+#if CONFIG_ZMK_KSCAN_MATRIX_SCAN_PERIOD_US > 0
+#define INST_SCAN_PERIOD_US(n) CONFIG_ZMK_KSCAN_MATRIX_SCAN_PERIOD_US
+// The debouncer counts in whole units, so debounce in scan periods when they're shorter than 1ms.
+#define INST_DEBOUNCE_UNITS(n, ms) DIV_ROUND_UP((ms)*USEC_PER_MSEC, INST_SCAN_PERIOD_US(n))
+#define INST_DEBOUNCE_SCAN_PERIOD(n) 1
+#else
+#define INST_SCAN_PERIOD_US(n) (DT_INST_PROP(n, debounce_scan_period_ms) * USEC_PER_MSEC)
+#define INST_DEBOUNCE_UNITS(n, ms) (ms)
+#define INST_DEBOUNCE_SCAN_PERIOD(n) DT_INST_PROP(n, debounce_scan_period_ms)
+#endif
+
+#define SCAN_TIME_BUCKETS 16
+
+#define COND_EAGER(eagercode, defercode)                                                           \
+    COND_CODE_1(CONFIG_ZMK_KSCAN_DEBOUNCE_EAGER, eagercode, defercode)
+
 #define USE_POLLING IS_ENABLED(CONFIG_ZMK_KSCAN_MATRIX_POLLING)
 #define USE_INTERRUPTS (!USE_POLLING)
 
@@ -75,13 +94,30 @@ struct kscan_matrix_data {
     /** Array of length config->inputs.len */
     struct kscan_matrix_irq_callback *irqs;
 #endif
-    /** Timestamp of the current or scheduled scan. */
+    /** Timestamp of the current or scheduled scan in microseconds. */
     int64_t scan_time;
+#if IS_ENABLED(CONFIG_ZMK_KSCAN_DEBOUNCE_EAGER)
+    /**
+     * Debounce timers for each output, with one timer per input in the order of data->inputs.
+     * Array of length (config->outputs.len * data->inputs.len)
+     */
+    uint16_t *timers;
+#else
     /**
      * Current state of the matrix as a flattened 2D array of length
      * (config->rows * config->cols)
      */
     struct zmk_debounce_state *matrix_state;
+#endif
+    /**
+     * Debounce state of the inputs for each output, as bitmasks with one bit per input in the order
+     * of data->inputs. Array of length (config->outputs.len * config->input_words)
+     */
+    struct zmk_debounce_bitmap *input_state;
+#if IS_ENABLED(CONFIG_ZMK_KSCAN_MATRIX_SCAN_TIME_HISTOGRAM)
+    uint32_t scan_count;
+    uint32_t scan_time_histogram[SCAN_TIME_BUCKETS];
+#endif
 };
 
 struct kscan_matrix_config {
@@ -89,11 +125,17 @@ struct kscan_matrix_config {
     struct zmk_debounce_config debounce_config;
     size_t rows;
     size_t cols;
-    int32_t debounce_scan_period_ms;
+    /** Number of words in each input bitmask. */
+    size_t input_words;
+    /** Time between scans while any key is pressed, in the units of debounce_config. */
+    int32_t debounce_scan_period;
+    int32_t scan_period_us;
     int32_t poll_period_ms;
     enum kscan_diode_direction diode_direction;
 };
 
+#if !IS_ENABLED(CONFIG_ZMK_KSCAN_DEBOUNCE_EAGER)
+
 /**
  * Get the index into a matrix state array from a row and column.
  */
@@ -114,15 +156,26 @@ static int state_index_io(const struct kscan_matrix_config *config, const int in
                : state_index_rc(config, input_idx, output_idx);
 }
 
+#endif /* !IS_ENABLED(CONFIG_ZMK_KSCAN_DEBOUNCE_EAGER) */
+
+/**
+ * Set every output to the same value. Consecutive outputs on the same port are set with one write,
+ * so outputs on an I/O expander such as a 595 shift register need only one bus transfer.
+ */
 static int kscan_matrix_set_all_outputs(const struct device *dev, const int value) {
     const struct kscan_matrix_config *config = dev->config;
 
-    for (int i = 0; i < config->outputs.len; i++) {
-        const struct gpio_dt_spec *gpio = &config->outputs.gpios[i].spec;
+    for (int i = 0; i < config->outputs.len;) {
+        const struct device *port = config->outputs.gpios[i].spec.port;
+        gpio_port_pins_t mask = 0;
 
-        int err = gpio_pin_set_dt(gpio, value);
+        for (; i < config->outputs.len && config->outputs.gpios[i].spec.port == port; i++) {
+            mask |= BIT(config->outputs.gpios[i].spec.pin);
+        }
+
+        int err = gpio_port_set_masked(port, mask, value ? mask : 0);
         if (err) {
-            LOG_ERR("Failed to set output %i to %i: %i", i, value, err);
+            LOG_ERR("Failed to set outputs on %s to %i: %i", port->name, value, err);
             return err;
         }
     }
@@ -130,6 +183,34 @@ static int kscan_matrix_set_all_outputs(const struct device *dev, const int valu
     return 0;
 }
 
+/**
+ * Set an output active while scanning. Unless the driver waits between outputs, this also sets the
+ * previous output inactive, with a single write if both are on the same port. Outputs on a 595
+ * shift register then need one SPI transfer per output instead of two.
+ */
+static int kscan_matrix_set_output_active(const struct device *dev, const int idx) {
+    const struct kscan_matrix_config *config = dev->config;
+    const struct gpio_dt_spec *gpio = &config->outputs.gpios[idx].spec;
+
+#if CONFIG_ZMK_KSCAN_MATRIX_WAIT_BETWEEN_OUTPUTS == 0
+    if (idx > 0) {
+        const struct gpio_dt_spec *prev = &config->outputs.gpios[idx - 1].spec;
+
+        if (prev->port == gpio->port) {
+            return gpio_port_set_masked(gpio->port, BIT(prev->pin) | BIT(gpio->pin),
+                                        BIT(gpio->pin));
+        }
+
+        int err = gpio_pin_set_dt(prev, 0);
+        if (err) {
+            return err;
+        }
+    }
+#endif
+
+    return gpio_pin_set_dt(gpio, 1);
+}
+
 #if USE_INTERRUPTS
 static int kscan_matrix_interrupt_configure(const struct device *dev, const gpio_flags_t flags) {
     const struct kscan_matrix_data *data = dev->data;
@@ -184,7 +265,7 @@ static void kscan_matrix_irq_callback_handler(const struct device *port, struct
     // Disable our interrupts temporarily to avoid re-entry while we scan.
     kscan_matrix_interrupt_disable(data->dev);
 
-    data->scan_time = k_uptime_get();
+    data->scan_time = k_ticks_to_us_floor64(k_uptime_ticks());
 
     k_work_reschedule(&data->work, K_NO_WAIT);
 }
@@ -194,9 +275,9 @@ static void kscan_matrix_read_continue(const struct device *dev) {
     const struct kscan_matrix_config *config = dev->config;
     struct kscan_matrix_data *data = dev->data;
 
-    data->scan_time += config->debounce_scan_period_ms;
+    data->scan_time += config->scan_period_us;
 
-    k_work_reschedule(&data->work, K_TIMEOUT_ABS_MS(data->scan_time));
+    k_work_reschedule(&data->work, K_TIMEOUT_ABS_US(data->scan_time));
 }
 
 static void kscan_matrix_read_end(const struct device *dev) {
@@ -207,22 +288,158 @@ static void kscan_matrix_read_end(const struct device *dev) {
     struct kscan_matrix_data *data = dev->data;
     const struct kscan_matrix_config *config = dev->config;
 
-    data->scan_time += config->poll_period_ms;
+    data->scan_time += config->poll_period_ms * USEC_PER_MSEC;
 
     // Return to polling slowly.
-    k_work_reschedule(&data->work, K_TIMEOUT_ABS_MS(data->scan_time));
+    k_work_reschedule(&data->work, K_TIMEOUT_ABS_US(data->scan_time));
+#endif
+}
+
+#if IS_ENABLED(CONFIG_ZMK_KSCAN_MATRIX_SCAN_TIME_HISTOGRAM)
+static void kscan_matrix_record_scan_time(const struct device *dev, const uint32_t start_cycles) {
+    struct kscan_matrix_data *data = dev->data;
+
+    const uint32_t elapsed_us = k_cyc_to_us_floor32(k_cycle_get_32() - start_cycles);
+    const uint32_t bucket =
+        MIN(elapsed_us / CONFIG_ZMK_KSCAN_MATRIX_SCAN_TIME_BUCKET_US, SCAN_TIME_BUCKETS - 1);
+
+    data->scan_time_histogram[bucket]++;
+    data->scan_count++;
+
+    if (data->scan_count % CONFIG_ZMK_KSCAN_MATRIX_SCAN_TIME_LOG_INTERVAL != 0) {
+        return;
+    }
+
+    LOG_INF("Scan times of %s over %u scans:", dev->name, data->scan_count);
+    for (int i = 0; i < SCAN_TIME_BUCKETS; i++) {
+        if (data->scan_time_histogram[i] > 0) {
+            LOG_INF("  < %uus: %u", (i + 1) * CONFIG_ZMK_KSCAN_MATRIX_SCAN_TIME_BUCKET_US,
+                    data->scan_time_histogram[i]);
+        }
+    }
+}
 #endif
+
+/**
+ * Read the inputs for the active output into bitmasks, one word at a time. Inputs are sorted by
+ * port, so each port is read only once.
+ */
+static int kscan_matrix_read_inputs(const struct device *dev, const int word, uint32_t *value,
+                                    struct kscan_gpio_port_state *state) {
+    const struct kscan_matrix_data *data = dev->data;
+    const int first = word * 32;
+    const int last = MIN(data->inputs.len, first + 32);
+
+    *value = 0;
+
+    for (int j = first; j < last; j++) {
+        const struct kscan_gpio *in_gpio = &data->inputs.gpios[j];
+
+        const int active = kscan_gpio_pin_get(in_gpio, state);
+        if (active < 0) {
+            LOG_ERR("Failed to read port %s: %i", in_gpio->spec.port->name, active);
+            return active;
+        }
+
+        WRITE_BIT(*value, j - first, active);
+    }
+
+    return 0;
+}
+
+static void kscan_matrix_report(const struct device *dev, const struct kscan_gpio *out_gpio,
+                                const struct kscan_gpio *in_gpio, const bool pressed) {
+    struct kscan_matrix_data *data = dev->data;
+    const struct kscan_matrix_config *config = dev->config;
+
+    const int r = (config->diode_direction == KSCAN_ROW2COL) ? out_gpio->index : in_gpio->index;
+    const int c = (config->diode_direction == KSCAN_ROW2COL) ? in_gpio->index : out_gpio->index;
+
+    LOG_DBG("Sending event at %i,%i state %s", r, c, pressed ? "on" : "off");
+    data->callback(dev, r, c, pressed);
+}
+
+#if IS_ENABLED(CONFIG_ZMK_KSCAN_DEBOUNCE_EAGER)
+
+/**
+ * Debounce the inputs of one output and report any which changed.
+ */
+static void kscan_matrix_debounce_inputs(const struct device *dev,
+                                         const struct kscan_gpio *out_gpio, const int output_idx,
+                                         const int word, const uint32_t value) {
+    struct kscan_matrix_data *data = dev->data;
+    const struct kscan_matrix_config *config = dev->config;
+    struct zmk_debounce_bitmap *bitmap =
+        &data->input_state[output_idx * config->input_words + word];
+    uint16_t *timers = &data->timers[output_idx * data->inputs.len + word * 32];
+
+    uint32_t changed = zmk_debounce_eager_update(bitmap, timers, value,
+                                                 config->debounce_scan_period,
+                                                 &config->debounce_config);
+
+    while (changed) {
+        const int bit = u32_count_trailing_zeros(changed);
+        changed &= changed - 1;
+
+        kscan_matrix_report(dev, out_gpio, &data->inputs.gpios[word * 32 + bit],
+                            bitmap->pressed & BIT(bit));
+    }
+}
+
+#else
+
+/**
+ * Debounce the inputs of one output which differ from their latched state or are still settling,
+ * and report any which changed.
+ */
+static void kscan_matrix_debounce_inputs(const struct device *dev,
+                                         const struct kscan_gpio *out_gpio, const int output_idx,
+                                         const int word, const uint32_t value) {
+    struct kscan_matrix_data *data = dev->data;
+    const struct kscan_matrix_config *config = dev->config;
+    struct zmk_debounce_bitmap *bitmap =
+        &data->input_state[output_idx * config->input_words + word];
+
+    uint32_t pending = (value ^ bitmap->pressed) | bitmap->unsettled;
+
+    while (pending) {
+        const int bit = u32_count_trailing_zeros(pending);
+        pending &= pending - 1;
+
+        const struct kscan_gpio *in_gpio = &data->inputs.gpios[word * 32 + bit];
+        const int index = state_index_io(config, in_gpio->index, out_gpio->index);
+        struct zmk_debounce_state *state = &data->matrix_state[index];
+
+        zmk_debounce_update(state, value & BIT(bit), config->debounce_scan_period,
+                            &config->debounce_config);
+        WRITE_BIT(bitmap->unsettled, bit, state->counter > 0);
+
+        if (zmk_debounce_get_changed(state)) {
+            const bool pressed = zmk_debounce_is_pressed(state);
+
+            WRITE_BIT(bitmap->pressed, bit, pressed);
+            kscan_matrix_report(dev, out_gpio, in_gpio, pressed);
+        }
+    }
 }
 
+#endif /* IS_ENABLED(CONFIG_ZMK_KSCAN_DEBOUNCE_EAGER) */
+
 static int kscan_matrix_read(const struct device *dev) {
     struct kscan_matrix_data *data = dev->data;
     const struct kscan_matrix_config *config = dev->config;
 
+#if IS_ENABLED(CONFIG_ZMK_KSCAN_MATRIX_SCAN_TIME_HISTOGRAM)
+    const uint32_t start_cycles = k_cycle_get_32();
+#endif
+
+    bool continue_scan = false;
+
     // Scan the matrix.
     for (int i = 0; i < config->outputs.len; i++) {
         const struct kscan_gpio *out_gpio = &config->outputs.gpios[i];
 
-        int err = gpio_pin_set_dt(&out_gpio->spec, 1);
+        int err = kscan_matrix_set_output_active(dev, i);
         if (err) {
             LOG_ERR("Failed to set output %i active: %i", out_gpio->index, err);
             return err;
@@ -233,49 +450,47 @@ static int kscan_matrix_read(const struct device *dev) {
 #endif
         struct kscan_gpio_port_state state = {0};
 
-        for (int j = 0; j < data->inputs.len; j++) {
-            const struct kscan_gpio *in_gpio = &data->inputs.gpios[j];
-
-            const int index = state_index_io(config, in_gpio->index, out_gpio->index);
-            const int active = kscan_gpio_pin_get(in_gpio, &state);
-            if (active < 0) {
-                LOG_ERR("Failed to read port %s: %i", in_gpio->spec.port->name, active);
-                return active;
+        for (int word = 0; word < config->input_words; word++) {
+            uint32_t value;
+            err = kscan_matrix_read_inputs(dev, word, &value, &state);
+            if (err) {
+                return err;
             }
 
-            zmk_debounce_update(&data->matrix_state[index], active, config->debounce_scan_period_ms,
-                                &config->debounce_config);
+            // Most scans find every input in its latched state, which needs no further work.
+            kscan_matrix_debounce_inputs(dev, out_gpio, i, word, value);
+
+            const struct zmk_debounce_bitmap *bitmap =
+                &data->input_state[i * config->input_words + word];
+            continue_scan = continue_scan || bitmap->pressed || bitmap->unsettled;
         }
 
+#if CONFIG_ZMK_KSCAN_MATRIX_WAIT_BETWEEN_OUTPUTS > 0
         err = gpio_pin_set_dt(&out_gpio->spec, 0);
         if (err) {
             LOG_ERR("Failed to set output %i inactive: %i", out_gpio->index, err);
             return err;
         }
 
-#if CONFIG_ZMK_KSCAN_MATRIX_WAIT_BETWEEN_OUTPUTS > 0
         k_busy_wait(CONFIG_ZMK_KSCAN_MATRIX_WAIT_BETWEEN_OUTPUTS);
 #endif
     }
 
-    // Process the new state.
-    bool continue_scan = false;
-
-    for (int r = 0; r < config->rows; r++) {
-        for (int c = 0; c < config->cols; c++) {
-            const int index = state_index_rc(config, r, c);
-            struct zmk_debounce_state *state = &data->matrix_state[index];
-
-            if (zmk_debounce_get_changed(state)) {
-                const bool pressed = zmk_debounce_is_pressed(state);
-
-                LOG_DBG("Sending event at %i,%i state %s", r, c, pressed ? "on" : "off");
-                data->callback(dev, r, c, pressed);
-            }
+#if CONFIG_ZMK_KSCAN_MATRIX_WAIT_BETWEEN_OUTPUTS == 0
+    if (config->outputs.len > 0) {
+        const struct kscan_gpio *out_gpio = &config->outputs.gpios[config->outputs.len - 1];
 
-            continue_scan = continue_scan || zmk_debounce_is_active(state);
+        int err = gpio_pin_set_dt(&out_gpio->spec, 0);
+        if (err) {
+            LOG_ERR("Failed to set output %i inactive: %i", out_gpio->index, err);
+            return err;
         }
     }
+#endif
+
+#if IS_ENABLED(CONFIG_ZMK_KSCAN_MATRIX_SCAN_TIME_HISTOGRAM)
+    kscan_matrix_record_scan_time(dev, start_cycles);
+#endif
 
     if (continue_scan) {
         // At least one key is pressed or the debouncer has not yet decided if
@@ -309,7 +524,7 @@ static int kscan_matrix_configure(const struct device *dev, const kscan_callback
 static int kscan_matrix_enable(const struct device *dev) {
     struct kscan_matrix_data *data = dev->data;
 
-    data->scan_time = k_uptime_get();
+    data->scan_time = k_ticks_to_us_floor64(k_uptime_ticks());
 
     // Read will automatically start interrupts/polling once done.
     return kscan_matrix_read(dev);
@@ -428,9 +643,9 @@ static const struct kscan_driver_api kscan_matrix_api = {
 };
 
 #define KSCAN_MATRIX_INIT(n)                                                                       \
-    BUILD_ASSERT(INST_DEBOUNCE_PRESS_MS(n) <= DEBOUNCE_COUNTER_MAX,                                \
+    BUILD_ASSERT(INST_DEBOUNCE_UNITS(n, INST_DEBOUNCE_PRESS_MS(n)) <= DEBOUNCE_COUNTER_MAX,        \
                  "ZMK_KSCAN_DEBOUNCE_PRESS_MS or debounce-press-ms is too large");                 \
-    BUILD_ASSERT(INST_DEBOUNCE_RELEASE_MS(n) <= DEBOUNCE_COUNTER_MAX,                              \
+    BUILD_ASSERT(INST_DEBOUNCE_UNITS(n, INST_DEBOUNCE_RELEASE_MS(n)) <= DEBOUNCE_COUNTER_MAX,      \
                  "ZMK_KSCAN_DEBOUNCE_RELEASE_MS or debounce-release-ms is too large");             \
                                                                                                    \
     static struct kscan_gpio kscan_matrix_rows_##n[] = {                                           \
@@ -439,7 +654,10 @@ static const struct kscan_driver_api kscan_matrix_api = {
     static struct kscan_gpio kscan_matrix_cols_##n[] = {                                           \
         LISTIFY(INST_COLS_LEN(n), KSCAN_GPIO_COL_CFG_INIT, (, ), n)};                              \
                                                                                                    \
-    static struct zmk_debounce_state kscan_matrix_state_##n[INST_MATRIX_LEN(n)];                   \
+    COND_EAGER((static uint16_t kscan_matrix_timers_##n[INST_MATRIX_LEN(n)];),                     \
+               (static struct zmk_debounce_state kscan_matrix_state_##n[INST_MATRIX_LEN(n)];))     \
+    static struct zmk_debounce_bitmap                                                              \
+        kscan_matrix_input_state_##n[INST_OUTPUTS_LEN(n) * INST_INPUT_WORDS(n)];                   \
                                                                                                    \
     COND_INTERRUPTS(                                                                               \
         (static struct kscan_matrix_irq_callback kscan_matrix_irqs_##n[INST_INPUTS_LEN(n)];))      \
@@ -447,20 +665,24 @@ static const struct kscan_driver_api kscan_matrix_api = {
     static struct kscan_matrix_data kscan_matrix_data_##n = {                                      \
         .inputs =                                                                                  \
             KSCAN_GPIO_LIST(COND_DIODE_DIR(n, (kscan_matrix_cols_##n), (kscan_matrix_rows_##n))),  \
-        .matrix_state = kscan_matrix_state_##n,                                                    \
+        COND_EAGER((.timers = kscan_matrix_timers_##n, ),                                          \
+                   (.matrix_state = kscan_matrix_state_##n, ))                                     \
+        .input_state = kscan_matrix_input_state_##n,                                               \
         COND_INTERRUPTS((.irqs = kscan_matrix_irqs_##n, ))};                                       \
                                                                                                    \
     static struct kscan_matrix_config kscan_matrix_config_##n = {                                  \
         .rows = ARRAY_SIZE(kscan_matrix_rows_##n),                                                 \
         .cols = ARRAY_SIZE(kscan_matrix_cols_##n),                                                 \
+        .input_words = INST_INPUT_WORDS(n),                                                        \
         .outputs =                                                                                 \
             KSCAN_GPIO_LIST(COND_DIODE_DIR(n, (kscan_matrix_rows_##n), (kscan_matrix_cols_##n))),  \
         .debounce_config =                                                                         \
             {                                                                                      \
-                .debounce_press_ms = INST_DEBOUNCE_PRESS_MS(n),                                    \
-                .debounce_release_ms = INST_DEBOUNCE_RELEASE_MS(n),                                \
+                .debounce_press_ms = INST_DEBOUNCE_UNITS(n, INST_DEBOUNCE_PRESS_MS(n)),            \
+                .debounce_release_ms = INST_DEBOUNCE_UNITS(n, INST_DEBOUNCE_RELEASE_MS(n)),        \
             },                                                                                     \
-        .debounce_scan_period_ms = DT_INST_PROP(n, debounce_scan_period_ms),                       \
+        .debounce_scan_period = INST_DEBOUNCE_SCAN_PERIOD(n),                                      \
+        .scan_period_us = INST_SCAN_PERIOD_US(n),                                                  \
         .poll_period_ms = DT_INST_PROP(n, poll_period_ms),                                         \
         .diode_direction = INST_DIODE_DIR(n),                                                      \
     };                                                                                             \
@@ -20,53 +20,57 @@
 
 LOG_MODULE_REGISTER(EC11, CONFIG_SENSOR_LOG_LEVEL);
 
-static int ec11_get_ab_state(const struct device *dev) {
+int ec11_get_ab_state(const struct device *dev) {
     const struct ec11_config *drv_cfg = dev->config;
 
     return (gpio_pin_get_dt(&drv_cfg->a) << 1) | gpio_pin_get_dt(&drv_cfg->b);
 }
 
-static int ec11_sample_fetch(const struct device *dev, enum sensor_channel chan) {
-    struct ec11_data *drv_data = dev->data;
-    const struct ec11_config *drv_cfg = dev->config;
-    uint8_t val;
-    int8_t delta;
-
-    __ASSERT_NO_MSG(chan == SENSOR_CHAN_ALL || chan == SENSOR_CHAN_ROTATION);
-
-    val = ec11_get_ab_state(dev);
-
-    LOG_DBG("prev: %d, new: %d", drv_data->ab_state, val);
-
-    switch (val | (drv_data->ab_state << 2)) {
+int8_t ec11_decode(uint8_t prev_ab_state, uint8_t ab_state) {
+    switch (ab_state | (prev_ab_state << 2)) {
     case 0b0010:
     case 0b0100:
     case 0b1101:
     case 0b1011:
-        delta = -1;
-        break;
+        return -1;
     case 0b0001:
     case 0b0111:
     case 0b1110:
     case 0b1000:
-        delta = 1;
-        break;
+        return 1;
     default:
-        delta = 0;
-        break;
+        return 0;
     }
+}
+
+static int ec11_sample_fetch(const struct device *dev, enum sensor_channel chan) {
+    struct ec11_data *drv_data = dev->data;
+    const struct ec11_config *drv_cfg = dev->config;
+    int16_t delta;
+
+    __ASSERT_NO_MSG(chan == SENSOR_CHAN_ALL || chan == SENSOR_CHAN_ROTATION);
+
+#if EC11_ACCUMULATE
+    delta = atomic_set(&drv_data->edge_pulses, 0);
+#else
+    uint8_t val = ec11_get_ab_state(dev);
+
+    LOG_DBG("prev: %d, new: %d", drv_data->ab_state, val);
+
+    delta = ec11_decode(drv_data->ab_state, val);
+    drv_data->ab_state = val;
+#endif
 
     LOG_DBG("Delta: %d", delta);
 
     drv_data->pulses += delta;
-    drv_data->ab_state = val;
 
     // TODO: Temporary code for backwards compatibility to support
     // the sensor channel rotation reporting *ticks* instead of delta of degrees.
     // REMOVE ME
     if (drv_cfg->steps == 0) {
         drv_data->ticks = drv_data->pulses / drv_cfg->resolution;
-        drv_data->delta = delta;
+        drv_data->delta = CLAMP(delta, -1, 1);
         drv_data->pulses %= drv_cfg->resolution;
     }
 
@@ -18,9 +18,17 @@ struct ec11_config {
     const uint8_t resolution;
 };
 
+// With a report interval, edges are decoded in the GPIO interrupt and reported together once per
+// interval, instead of being reported one at a time.
+#if defined(CONFIG_EC11_REPORT_INTERVAL_MS) && CONFIG_EC11_REPORT_INTERVAL_MS > 0
+#define EC11_ACCUMULATE 1
+#else
+#define EC11_ACCUMULATE 0
+#endif
+
 struct ec11_data {
     uint8_t ab_state;
-    int8_t pulses;
+    int16_t pulses;
     int8_t ticks;
     int8_t delta;
 
@@ -32,6 +40,12 @@ struct ec11_data {
     sensor_trigger_handler_t handler;
     const struct sensor_trigger *trigger;
 
+#if EC11_ACCUMULATE
+    // Pulses decoded in the GPIO interrupt since the last sample was fetched.
+    atomic_t edge_pulses;
+    struct k_timer report_timer;
+#endif
+
 #if defined(CONFIG_EC11_TRIGGER_OWN_THREAD)
     K_THREAD_STACK_MEMBER(thread_stack, CONFIG_EC11_THREAD_STACK_SIZE);
     struct k_sem gpio_sem;
@@ -43,6 +57,11 @@ struct ec11_data {
 #endif /* CONFIG_EC11_TRIGGER */
 };
 
+int ec11_get_ab_state(const struct device *dev);
+
+// Returns the number of pulses, -1, 0 or 1, moved between two states of the A and B pins.
+int8_t ec11_decode(uint8_t prev_ab_state, uint8_t ab_state);
+
 #ifdef CONFIG_EC11_TRIGGER
 
 int ec11_trigger_set(const struct device *dev, const struct sensor_trigger *trig,
@@ -33,19 +33,57 @@ static inline void setup_int(const struct device *dev, bool enable) {
     }
 }
 
+static void ec11_notify(struct ec11_data *drv_data) {
+#if defined(CONFIG_EC11_TRIGGER_OWN_THREAD)
+    k_sem_give(&drv_data->gpio_sem);
+#elif defined(CONFIG_EC11_TRIGGER_GLOBAL_THREAD)
+    k_work_submit(&drv_data->work);
+#endif
+}
+
+#if EC11_ACCUMULATE
+
+static void ec11_report_timer_expired(struct k_timer *timer) {
+    struct ec11_data *drv_data = CONTAINER_OF(timer, struct ec11_data, report_timer);
+
+    ec11_notify(drv_data);
+}
+
+// Decodes each edge as it happens, and reports the pulses added up over the report interval
+// which starts at the first edge after the last report.
+static void ec11_gpio_edge(struct ec11_data *drv_data) {
+    const uint8_t ab_state = ec11_get_ab_state(drv_data->dev);
+    const int8_t delta = ec11_decode(drv_data->ab_state, ab_state);
+
+    drv_data->ab_state = ab_state;
+
+    if (delta == 0) {
+        return;
+    }
+
+    atomic_add(&drv_data->edge_pulses, delta);
+
+    if (k_timer_remaining_get(&drv_data->report_timer) == 0) {
+        k_timer_start(&drv_data->report_timer, K_MSEC(CONFIG_EC11_REPORT_INTERVAL_MS), K_NO_WAIT);
+    }
+}
+
+#else
+
+static void ec11_gpio_edge(struct ec11_data *drv_data) {
+    setup_int(drv_data->dev, false);
+    ec11_notify(drv_data);
+}
+
+#endif /* EC11_ACCUMULATE */
+
 static void ec11_a_gpio_callback(const struct device *dev, struct gpio_callback *cb,
                                  uint32_t pins) {
     struct ec11_data *drv_data = CONTAINER_OF(cb, struct ec11_data, a_gpio_cb);
 
     LOG_DBG("");
 
-    setup_int(drv_data->dev, false);
-
-#if defined(CONFIG_EC11_TRIGGER_OWN_THREAD)
-    k_sem_give(&drv_data->gpio_sem);
-#elif defined(CONFIG_EC11_TRIGGER_GLOBAL_THREAD)
-    k_work_submit(&drv_data->work);
-#endif
+    ec11_gpio_edge(drv_data);
 }
 
 static void ec11_b_gpio_callback(const struct device *dev, struct gpio_callback *cb,
@@ -54,13 +92,7 @@ static void ec11_b_gpio_callback(const struct device *dev, struct gpio_callback
 
     LOG_DBG("");
 
-    setup_int(drv_data->dev, false);
-
-#if defined(CONFIG_EC11_TRIGGER_OWN_THREAD)
-    k_sem_give(&drv_data->gpio_sem);
-#elif defined(CONFIG_EC11_TRIGGER_GLOBAL_THREAD)
-    k_work_submit(&drv_data->work);
-#endif
+    ec11_gpio_edge(drv_data);
 }
 
 static void ec11_thread_cb(const struct device *dev) {
@@ -68,7 +100,10 @@ static void ec11_thread_cb(const struct device *dev) {
 
     drv_data->handler(dev, drv_data->trigger);
 
-    setup_int(dev, true);
+    // Interrupts stay enabled while accumulating edges.
+    if (!EC11_ACCUMULATE) {
+        setup_int(dev, true);
+    }
 }
 
 #ifdef CONFIG_EC11_TRIGGER_OWN_THREAD
@@ -116,6 +151,11 @@ int ec11_init_interrupt(const struct device *dev) {
     const struct ec11_config *drv_cfg = dev->config;
 
     drv_data->dev = dev;
+
+#if EC11_ACCUMULATE
+    k_timer_init(&drv_data->report_timer, ec11_report_timer_expired, NULL);
+#endif
+
     /* setup gpio interrupt */
 
     gpio_init_callback(&drv_data->a_gpio_cb, ec11_a_gpio_callback, BIT(drv_cfg->a.pin));
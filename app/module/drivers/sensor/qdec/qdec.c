@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2023 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <zephyr/device.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/__assert.h>
+#include <zephyr/logging/log.h>
+
+#include "qdec.h"
+
+#define FULL_ROTATION 360
+
+LOG_MODULE_REGISTER(ZMK_QDEC, CONFIG_SENSOR_LOG_LEVEL);
+
+void zmk_qdec_report(const struct device *dev, int32_t pulses) {
+    struct zmk_qdec_data *data = dev->data;
+
+    if (pulses == 0) {
+        return;
+    }
+
+    atomic_add(&data->reported_pulses, pulses);
+
+    // The keymap sensors defer to a work item when triggered from an interrupt, so there is no
+    // need for one here as well.
+    sensor_trigger_handler_t handler = data->handler;
+    if (handler != NULL) {
+        handler(dev, data->trigger);
+    }
+}
+
+static int zmk_qdec_trigger_set(const struct device *dev, const struct sensor_trigger *trig,
+                                sensor_trigger_handler_t handler) {
+    struct zmk_qdec_data *data = dev->data;
+
+    if (trig->type != SENSOR_TRIG_DATA_READY || trig->chan != SENSOR_CHAN_ROTATION) {
+        return -ENOTSUP;
+    }
+
+    unsigned int key = irq_lock();
+    data->handler = handler;
+    data->trigger = trig;
+    irq_unlock(key);
+
+    return 0;
+}
+
+static int zmk_qdec_sample_fetch(const struct device *dev, enum sensor_channel chan) {
+    struct zmk_qdec_data *data = dev->data;
+
+    __ASSERT_NO_MSG(chan == SENSOR_CHAN_ALL || chan == SENSOR_CHAN_ROTATION);
+
+    int32_t delta = atomic_set(&data->reported_pulses, 0);
+
+    LOG_DBG("Delta: %d", delta);
+
+    data->pulses += delta;
+
+    return 0;
+}
+
+static int zmk_qdec_channel_get(const struct device *dev, enum sensor_channel chan,
+                                struct sensor_value *val) {
+    struct zmk_qdec_data *data = dev->data;
+    const struct zmk_qdec_config *cfg = dev->config;
+    int32_t pulses = data->pulses;
+
+    if (chan != SENSOR_CHAN_ROTATION) {
+        return -ENOTSUP;
+    }
+
+    data->pulses = 0;
+
+    val->val1 = (pulses * FULL_ROTATION) / cfg->steps;
+    val->val2 = (pulses * FULL_ROTATION) % cfg->steps;
+    if (val->val2 != 0) {
+        val->val2 *= 1000000;
+        val->val2 /= cfg->steps;
+    }
+
+    return 0;
+}
+
+const struct sensor_driver_api zmk_qdec_driver_api = {
+    .trigger_set = zmk_qdec_trigger_set,
+    .sample_fetch = zmk_qdec_sample_fetch,
+    .channel_get = zmk_qdec_channel_get,
+};
@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2023 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <zephyr/device.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/sys/atomic.h>
+
+// The config and data of each QDEC backend start with these, so that every backend shares the same
+// sensor API and only has to report the pulses counted by its decoder.
+struct zmk_qdec_config {
+    const uint16_t steps;
+};
+
+struct zmk_qdec_data {
+    // Pulses reported by the decoder since the last sample was fetched.
+    atomic_t reported_pulses;
+    int32_t pulses;
+
+    sensor_trigger_handler_t handler;
+    const struct sensor_trigger *trigger;
+};
+
+extern const struct sensor_driver_api zmk_qdec_driver_api;
+
+/**
+ * @brief Add pulses counted by the decoder to the next sample, and notify the trigger handler.
+ *
+ * Safe to call from an interrupt.
+ */
+void zmk_qdec_report(const struct device *dev, int32_t pulses);
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2023 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#define DT_DRV_COMPAT zmk_qdec_emul
+
+#include <zephyr/device.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "qdec.h"
+
+LOG_MODULE_DECLARE(ZMK_QDEC, CONFIG_SENSOR_LOG_LEVEL);
+
+// Replays the movement listed in the devicetree into an emulated accumulator, which is reported
+// once per report period if it is non-zero, the same way the QDEC peripheral does.
+struct qdec_emul_config {
+    struct zmk_qdec_config common;
+    uint32_t report_period_ms;
+    // Pairs of a delay in milliseconds and the pulses to move after it. Pulses are signed, but are
+    // stored unsigned since that is how the devicetree encodes negative cells.
+    const uint32_t *events;
+    size_t events_len;
+};
+
+struct qdec_emul_data {
+    struct zmk_qdec_data common;
+    const struct device *dev;
+
+    atomic_t acc;
+    size_t event_index;
+    struct k_work_delayable event_work;
+    struct k_timer report_timer;
+};
+
+static void qdec_emul_schedule_next_event(struct qdec_emul_data *data) {
+    const struct qdec_emul_config *cfg = data->dev->config;
+
+    if (data->event_index < cfg->events_len) {
+        k_work_schedule(&data->event_work, K_MSEC(cfg->events[data->event_index]));
+    }
+}
+
+static void qdec_emul_event_work_handler(struct k_work *work) {
+    struct k_work_delayable *dwork = k_work_delayable_from_work(work);
+    struct qdec_emul_data *data = CONTAINER_OF(dwork, struct qdec_emul_data, event_work);
+    const struct qdec_emul_config *cfg = data->dev->config;
+    int32_t pulses = (int32_t)cfg->events[data->event_index + 1];
+
+    LOG_DBG("Emulating %d pulses", pulses);
+
+    atomic_add(&data->acc, pulses);
+
+    data->event_index += 2;
+    qdec_emul_schedule_next_event(data);
+}
+
+static void qdec_emul_report_timer_handler(struct k_timer *timer) {
+    struct qdec_emul_data *data = CONTAINER_OF(timer, struct qdec_emul_data, report_timer);
+
+    zmk_qdec_report(data->dev, atomic_set(&data->acc, 0));
+}
+
+static int qdec_emul_init(const struct device *dev) {
+    struct qdec_emul_data *data = dev->data;
+    const struct qdec_emul_config *cfg = dev->config;
+
+    data->dev = dev;
+
+    k_work_init_delayable(&data->event_work, qdec_emul_event_work_handler);
+    k_timer_init(&data->report_timer, qdec_emul_report_timer_handler, NULL);
+
+    k_timer_start(&data->report_timer, K_MSEC(cfg->report_period_ms),
+                  K_MSEC(cfg->report_period_ms));
+    qdec_emul_schedule_next_event(data);
+
+    return 0;
+}
+
+#define QDEC_EMUL_INST(n)                                                                          \
+    BUILD_ASSERT(DT_INST_PROP_LEN(n, events) % 2 == 0,                                             \
+                 "Emulated encoder events must be pairs of a delay and pulses");                   \
+    static struct qdec_emul_data qdec_emul_data_##n;                                               \
+    static const uint32_t qdec_emul_events_##n[] = DT_INST_PROP(n, events);                        \
+    static const struct qdec_emul_config qdec_emul_config_##n = {                                  \
+        .common = {.steps = DT_INST_PROP(n, steps)},                                               \
+        .report_period_ms = DT_INST_PROP(n, report_period_ms),                                     \
+        .events = qdec_emul_events_##n,                                                            \
+        .events_len = DT_INST_PROP_LEN(n, events),                                                 \
+    };                                                                                             \
+    DEVICE_DT_INST_DEFINE(n, qdec_emul_init, NULL, &qdec_emul_data_##n, &qdec_emul_config_##n,     \
+                          POST_KERNEL, CONFIG_SENSOR_INIT_PRIORITY, &zmk_qdec_driver_api);
+
+DT_INST_FOREACH_STATUS_OKAY(QDEC_EMUL_INST)
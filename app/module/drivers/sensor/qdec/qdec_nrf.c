@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2023 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#define DT_DRV_COMPAT zmk_qdec_nrf
+
+#include <zephyr/device.h>
+#include <zephyr/drivers/pinctrl.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include <nrfx_qdec.h>
+
+#include "qdec.h"
+
+LOG_MODULE_DECLARE(ZMK_QDEC, CONFIG_SENSOR_LOG_LEVEL);
+
+// nrfx drives the one QDEC peripheral through global state, so only one encoder can use it.
+BUILD_ASSERT(DT_NUM_INST_STATUS_OKAY(DT_DRV_COMPAT) == 1,
+             "Only one encoder can use the QDEC peripheral");
+
+#define QDEC_NODE DT_INST(0, nordic_nrf_qdec)
+
+// Zephyr's own QDEC driver binds to the peripheral's node when it is enabled.
+BUILD_ASSERT(!DT_NODE_HAS_STATUS(QDEC_NODE, okay),
+             "The QDEC peripheral's node must be disabled for it to be used by zmk,qdec-nrf");
+
+struct qdec_nrf_config {
+    struct zmk_qdec_config common;
+    const struct pinctrl_dev_config *pcfg;
+    nrf_qdec_sampleper_t sample_period;
+    nrf_qdec_reportper_t report_period;
+    uint16_t led_pre_us;
+    bool debounce;
+};
+
+struct qdec_nrf_data {
+    struct zmk_qdec_data common;
+};
+
+static void qdec_nrf_event_handler(nrfx_qdec_event_t event) {
+    if (event.type != NRF_QDEC_EVENT_REPORTRDY) {
+        return;
+    }
+
+    // Transitions where both A and B changed between two samples can't be decoded. The sample
+    // period is too long for how fast the encoder is turning if this happens often.
+    if (event.data.report.accdbl > 0) {
+        LOG_DBG("Missed %d transitions", event.data.report.accdbl);
+    }
+
+    zmk_qdec_report(DEVICE_DT_INST_GET(0), event.data.report.acc);
+}
+
+static int qdec_nrf_init(const struct device *dev) {
+    const struct qdec_nrf_config *cfg = dev->config;
+
+    IRQ_CONNECT(DT_IRQN(QDEC_NODE), DT_IRQ(QDEC_NODE, priority), nrfx_isr, nrfx_qdec_irq_handler,
+                0);
+
+    int err = pinctrl_apply_state(cfg->pcfg, PINCTRL_STATE_DEFAULT);
+    if (err < 0) {
+        LOG_ERR("Failed to apply pin configuration (%d)", err);
+        return err;
+    }
+
+    // The REPORTRDY interrupt only fires at the end of a report period in which the accumulator
+    // is non-zero, so an idle encoder never wakes the CPU.
+    const nrfx_qdec_config_t qdec_config = {
+        .reportper = cfg->report_period,
+        .sampleper = cfg->sample_period,
+        .skip_gpio_cfg = true,
+        .skip_psel_cfg = true,
+        .ledpre = cfg->led_pre_us,
+        .ledpol = NRF_QDEC_LEPOL_ACTIVE_HIGH,
+        .dbfen = cfg->debounce,
+        .sample_inten = false,
+        .interrupt_priority = DT_IRQ(QDEC_NODE, priority),
+    };
+
+    if (nrfx_qdec_init(&qdec_config, qdec_nrf_event_handler) != NRFX_SUCCESS) {
+        LOG_ERR("Failed to initialize the QDEC peripheral");
+        return -EBUSY;
+    }
+
+    nrfx_qdec_enable();
+
+    return 0;
+}
+
+PINCTRL_DT_INST_DEFINE(0);
+
+static struct qdec_nrf_data qdec_nrf_data;
+
+// The devicetree enums list the periods in the order of the peripheral's register values.
+static const struct qdec_nrf_config qdec_nrf_config = {
+    .common = {.steps = DT_INST_PROP(0, steps)},
+    .pcfg = PINCTRL_DT_INST_DEV_CONFIG_GET(0),
+    .sample_period = DT_INST_ENUM_IDX(0, sample_period_us),
+    .report_period = DT_INST_ENUM_IDX(0, report_period_samples),
+    .led_pre_us = DT_INST_PROP(0, led_pre_us),
+    .debounce = DT_INST_PROP(0, debounce),
+};
+
+DEVICE_DT_INST_DEFINE(0, qdec_nrf_init, NULL, &qdec_nrf_data, &qdec_nrf_config, POST_KERNEL,
+                      CONFIG_SENSOR_INIT_PRIORITY, &zmk_qdec_driver_api);
@@ -20,12 +20,30 @@ struct zmk_debounce_state {
 };
 
 struct zmk_debounce_config {
-    /** Duration a switch must be pressed to latch as pressed. */
+    /**
+     * Duration a switch must be pressed to latch as pressed. With eager debouncing, this is instead
+     * the duration after latching as pressed that the switch ignores bounces.
+     */
     uint32_t debounce_press_ms;
     /** Duration a switch must be released to latch as released. */
     uint32_t debounce_release_ms;
 };
 
+/**
+ * Debounce state of up to 32 switches, as bitmasks with one bit per switch.
+ */
+struct zmk_debounce_bitmap {
+    /** Switches which are latched as pressed. */
+    uint32_t pressed;
+    /**
+     * Switches which the debouncer has not settled on yet. If any bit is set, the kscan driver
+     * should continue to poll quickly.
+     */
+    uint32_t unsettled;
+    /** Switches which are waiting to latch as released. Only used by eager debouncing. */
+    uint32_t releasing;
+};
+
 /**
  * Debounces one switch.
  *
@@ -54,3 +72,22 @@ bool zmk_debounce_is_pressed(const struct zmk_debounce_state *state);
  * debounce_update.
  */
 bool zmk_debounce_get_changed(const struct zmk_debounce_state *state);
+
+/**
+ * Eagerly debounces up to 32 switches.
+ *
+ * A press latches as soon as it is read, and then bounces are ignored for debounce_press_ms. A
+ * release latches only once the switch has read as released for debounce_release_ms.
+ *
+ * @param state The state for the switches to debounce.
+ * @param timers Array of one timer per switch, indexed by bit. Only the timers of unsettled
+ * switches are used, so switches which are never active need no storage.
+ * @param active Bitmask of the switches which are currently pressed.
+ * @param elapsed_ms Time elapsed since the previous update in milliseconds.
+ * @param config Debounce settings.
+ *
+ * @returns a bitmask of the switches whose pressed state changed.
+ */
+uint32_t zmk_debounce_eager_update(struct zmk_debounce_bitmap *state, uint16_t *timers,
+                                   const uint32_t active, const int elapsed_ms,
+                                   const struct zmk_debounce_config *config);
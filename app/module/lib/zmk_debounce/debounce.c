@@ -4,6 +4,8 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <zephyr/sys/math_extras.h>
+
 #include <zmk/debounce.h>
 
 static uint32_t get_threshold(const struct zmk_debounce_state *state,
@@ -59,4 +61,58 @@ bool zmk_debounce_is_active(const struct zmk_debounce_state *state) {
 
 bool zmk_debounce_is_pressed(const struct zmk_debounce_state *state) { return state->pressed; }
 
-bool zmk_debounce_get_changed(const struct zmk_debounce_state *state) { return state->changed; }
\ No newline at end of file
+bool zmk_debounce_get_changed(const struct zmk_debounce_state *state) { return state->changed; }
+
+static void start_timers(uint16_t *timers, uint32_t mask, const uint32_t duration) {
+    while (mask) {
+        const int bit = u32_count_trailing_zeros(mask);
+        mask &= mask - 1;
+
+        timers[bit] = duration;
+    }
+}
+
+uint32_t zmk_debounce_eager_update(struct zmk_debounce_bitmap *state, uint16_t *timers,
+                                   const uint32_t active, const int elapsed_ms,
+                                   const struct zmk_debounce_config *config) {
+    // Run down the timers of unsettled switches. Switches which aren't pressed and have no timer
+    // running need no work at all, so most updates are only a few bitwise operations.
+    uint32_t expired = 0;
+    uint32_t running = state->unsettled;
+
+    while (running) {
+        const int bit = u32_count_trailing_zeros(running);
+        running &= running - 1;
+
+        if (timers[bit] > elapsed_ms) {
+            timers[bit] -= elapsed_ms;
+        } else {
+            timers[bit] = 0;
+            expired |= BIT(bit);
+        }
+    }
+
+    // A switch which reads as pressed again before its release timer expires was bouncing.
+    const uint32_t bounced = state->releasing & active;
+    const uint32_t released = state->releasing & expired & ~bounced;
+
+    state->releasing &= ~(bounced | released);
+    state->unsettled &= ~(expired | bounced);
+    state->pressed &= ~released;
+
+    // Latch presses immediately, then ignore bounces until the press timer expires.
+    const uint32_t pressed = active & ~state->pressed;
+
+    state->pressed |= pressed;
+    state->unsettled |= pressed;
+    start_timers(timers, pressed, config->debounce_press_ms);
+
+    // Start the release timer of any settled switch which reads as released.
+    const uint32_t releasing = state->pressed & ~active & ~state->unsettled;
+
+    state->releasing |= releasing;
+    state->unsettled |= releasing;
+    start_timers(timers, releasing, config->debounce_release_ms);
+
+    return pressed | released;
+}
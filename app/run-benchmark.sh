@@ -0,0 +1,38 @@
+#!/bin/sh
+
+# Copyright (c) 2023 The ZMK Contributors
+# SPDX-License-Identifier: MIT
+
+if [ -z "$1" ]; then
+    echo "Usage: ./run-benchmark.sh <path to benchmark> [extra arguments]"
+    exit 1
+fi
+
+benchmark="$1"
+shift
+
+name=$(basename $benchmark)
+build_dir="build/benchmarks/$name"
+
+if [ -f $benchmark/native_posix_64.keymap ]; then
+    # Benchmarks of the whole firmware are configured like tests. Their kscan events are
+    # generated, with any extra arguments passed to the generator.
+    config_dir="$build_dir/config"
+    mkdir -p $config_dir
+    cp $benchmark/native_posix_64.keymap $benchmark/native_posix_64.conf $config_dir
+    python3 $benchmark/generate-events.py "$@" > $config_dir/events.dtsi || exit 1
+
+    executable="$build_dir/zephyr/zmk.exe"
+    west build -p -d $build_dir -b native_posix_64 -- -DZMK_CONFIG="$(pwd)/$config_dir" > /dev/null 2>&1
+else
+    # Other benchmarks are standalone applications, with any extra arguments passed to CMake.
+    executable="$build_dir/zephyr/zephyr.exe"
+    west build -p -d $build_dir -b native_posix_64 $benchmark -- "$@" > /dev/null 2>&1
+fi
+
+if [ $? -gt 0 ]; then
+    echo "FAILED: $benchmark did not build"
+    exit 1
+fi
+
+./$executable | sed -e "s/.*> //"
@@ -4,63 +4,279 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <string.h>
+
 #include <zmk/behavior_queue.h>
 
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
 #include <drivers/behavior.h>
 
+#if IS_ENABLED(CONFIG_SHELL)
+#include <zephyr/shell/shell.h>
+#endif
+
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
+#define TIMELINE_COUNT CONFIG_ZMK_BEHAVIORS_QUEUE_TIMELINES
+#define TIMELINE_SIZE DIV_ROUND_UP(CONFIG_ZMK_BEHAVIORS_QUEUE_SIZE, TIMELINE_COUNT)
+
+enum q_item_type {
+    Q_ITEM_PRESS,
+    Q_ITEM_RELEASE,
+    Q_ITEM_TAP,
+};
+
 struct q_item {
     uint32_t position;
     struct zmk_behavior_binding binding;
-    bool press : 1;
-    uint32_t wait : 31;
+    uint32_t wait;
+    uint32_t tap_ms;
+    // Taps left to invoke, for tap items.
+    uint16_t taps;
+    uint8_t type;
+    // Set between the press and release of a tap.
+    bool tap_pressed;
 };
 
-K_MSGQ_DEFINE(zmk_behavior_queue_msgq, sizeof(struct q_item), CONFIG_ZMK_BEHAVIORS_QUEUE_SIZE, 4);
+// Steps on one timeline run in order, waiting between them as requested. Timelines run
+// independently of each other.
+struct timeline {
+    struct q_item items[TIMELINE_SIZE];
+    uint8_t head;
+    uint8_t len;
+    // Uptime at which the next step may run.
+    int64_t ready_at;
+};
+
+BUILD_ASSERT(TIMELINE_SIZE <= UINT8_MAX, "Behavior queue timelines are too large");
+
+static struct timeline timelines[TIMELINE_COUNT];
+static struct zmk_behavior_queue_stats stats;
+static bool processing;
 
 static void behavior_queue_process_next(struct k_work *work);
 static K_WORK_DELAYABLE_DEFINE(queue_work, behavior_queue_process_next);
 
-static void behavior_queue_process_next(struct k_work *work) {
-    struct q_item item = {.wait = 0};
+static struct timeline *timeline_for(uint32_t position) {
+    return &timelines[position % TIMELINE_COUNT];
+}
 
-    while (k_msgq_get(&zmk_behavior_queue_msgq, &item, K_NO_WAIT) == 0) {
-        LOG_DBG("Invoking %s: 0x%02x 0x%02x", item.binding.behavior_dev, item.binding.param1,
-                item.binding.param2);
+static struct q_item *timeline_item(struct timeline *timeline, uint8_t index) {
+    return &timeline->items[(timeline->head + index) % TIMELINE_SIZE];
+}
 
-        struct zmk_behavior_binding_event event = {.position = item.position,
-                                                   .timestamp = k_uptime_get()};
+static void timeline_pop(struct timeline *timeline) {
+    timeline->head = (timeline->head + 1) % TIMELINE_SIZE;
+    timeline->len--;
+    stats.depth--;
+}
 
-        if (item.press) {
-            behavior_keymap_binding_pressed(&item.binding, event);
-        } else {
-            behavior_keymap_binding_released(&item.binding, event);
-        }
+// Invokes the next step of the timeline, and returns how long to wait before the one after it.
+static uint32_t timeline_run_step(struct timeline *timeline) {
+    struct q_item *item = timeline_item(timeline, 0);
+    struct zmk_behavior_binding binding = item->binding;
+    struct zmk_behavior_binding_event event = {.position = item->position,
+                                               .timestamp = k_uptime_get()};
+    uint32_t wait = item->wait;
 
-        LOG_DBG("Processing next queued behavior in %dms", item.wait);
+    LOG_DBG("Invoking %s: 0x%02x 0x%02x", binding.behavior_dev, binding.param1, binding.param2);
 
-        if (item.wait > 0) {
-            k_work_schedule(&queue_work, K_MSEC(item.wait));
+    switch (item->type) {
+    case Q_ITEM_PRESS:
+        timeline_pop(timeline);
+        behavior_keymap_binding_pressed(&binding, event);
+        break;
+    case Q_ITEM_RELEASE:
+        timeline_pop(timeline);
+        behavior_keymap_binding_released(&binding, event);
+        break;
+    case Q_ITEM_TAP:
+        if (!item->tap_pressed) {
+            item->tap_pressed = true;
+            wait = item->tap_ms;
+            behavior_keymap_binding_pressed(&binding, event);
             break;
         }
+
+        item->tap_pressed = false;
+        if (--item->taps == 0) {
+            timeline_pop(timeline);
+        }
+        behavior_keymap_binding_released(&binding, event);
+        break;
+    }
+
+    return wait;
+}
+
+static void behavior_queue_process_next(struct k_work *work) {
+    int64_t next_ready_at = INT64_MAX;
+    bool progress;
+
+    processing = true;
+
+    // Invoked behaviors may queue more steps, including on timelines that were already visited.
+    do {
+        progress = false;
+        next_ready_at = INT64_MAX;
+
+        for (int i = 0; i < TIMELINE_COUNT; i++) {
+            struct timeline *timeline = &timelines[i];
+
+            while (timeline->len > 0 && timeline->ready_at <= k_uptime_get()) {
+                uint32_t wait = timeline_run_step(timeline);
+
+                LOG_DBG("Processing next queued behavior in %dms", wait);
+                timeline->ready_at = k_uptime_get() + wait;
+                progress = true;
+            }
+
+            if (timeline->len > 0) {
+                next_ready_at = MIN(next_ready_at, timeline->ready_at);
+            }
+        }
+    } while (progress);
+
+    processing = false;
+
+    if (next_ready_at != INT64_MAX) {
+        k_work_reschedule(&queue_work, K_TIMEOUT_ABS_MS(next_ready_at));
+    }
+}
+
+static int timeline_push(struct timeline *timeline, const struct q_item *item) {
+    if (timeline->len >= TIMELINE_SIZE) {
+        stats.dropped++;
+        LOG_WRN("Behavior queue timeline full, dropping %s (%d dropped)",
+                item->binding.behavior_dev, stats.dropped);
+        return -ENOMEM;
+    }
+
+    *timeline_item(timeline, timeline->len++) = *item;
+    stats.depth++;
+    stats.high_water = MAX(stats.high_water, timeline->len);
+
+    return 0;
+}
+
+static void start_processing(struct timeline *timeline) {
+    // Run straight away if the timeline is ready, unless this was queued by a behavior which is
+    // being invoked from the queue, in which case the loop picks it up.
+    if (processing) {
+        return;
+    }
+
+    if (timeline->ready_at <= k_uptime_get()) {
+        behavior_queue_process_next(&queue_work.work);
+    } else {
+        // The work may be scheduled for later than this timeline is ready, so let it work out
+        // when to run next.
+        k_work_reschedule(&queue_work, K_NO_WAIT);
     }
 }
 
 int zmk_behavior_queue_add(uint32_t position, const struct zmk_behavior_binding binding, bool press,
                            uint32_t wait) {
-    struct q_item item = {.press = press, .binding = binding, .wait = wait};
+    struct timeline *timeline = timeline_for(position);
+    struct q_item item = {
+        .position = position,
+        .binding = binding,
+        .wait = wait,
+        .type = press ? Q_ITEM_PRESS : Q_ITEM_RELEASE,
+    };
 
-    const int ret = k_msgq_put(&zmk_behavior_queue_msgq, &item, K_NO_WAIT);
+    const int ret = timeline_push(timeline, &item);
     if (ret < 0) {
         return ret;
     }
 
-    if (!k_work_delayable_is_pending(&queue_work)) {
-        behavior_queue_process_next(&queue_work.work);
+    start_processing(timeline);
+
+    return 0;
+}
+
+static bool same_binding(const struct zmk_behavior_binding *a,
+                         const struct zmk_behavior_binding *b) {
+    return zmk_behavior_get_binding_device(a) == zmk_behavior_get_binding_device(b) &&
+           a->param1 == b->param1 && a->param2 == b->param2;
+}
+
+int zmk_behavior_queue_add_taps(uint32_t position, const struct zmk_behavior_binding binding,
+                                uint16_t count, uint32_t tap_ms, uint32_t wait) {
+    if (count == 0) {
+        return 0;
+    }
+
+    struct timeline *timeline = timeline_for(position);
+
+    if (timeline->len > 0) {
+        struct q_item *last = timeline_item(timeline, timeline->len - 1);
+
+        if (last->type == Q_ITEM_TAP && last->position == position && last->tap_ms == tap_ms &&
+            last->wait == wait && last->taps <= UINT16_MAX - count &&
+            same_binding(&last->binding, &binding)) {
+            last->taps += count;
+            stats.coalesced_taps += count;
+            LOG_DBG("Added %d taps of %s to the last queued tap, %d left", count,
+                    binding.behavior_dev, last->taps);
+            return 0;
+        }
+    }
+
+    struct q_item item = {
+        .position = position,
+        .binding = binding,
+        .wait = wait,
+        .tap_ms = tap_ms,
+        .taps = count,
+        .type = Q_ITEM_TAP,
+    };
+
+    const int ret = timeline_push(timeline, &item);
+    if (ret < 0) {
+        return ret;
     }
 
+    start_processing(timeline);
+
     return 0;
 }
+
+void zmk_behavior_queue_get_stats(struct zmk_behavior_queue_stats *result) { *result = stats; }
+
+#if IS_ENABLED(CONFIG_SHELL)
+
+static int cmd_behavior_queue_stats(const struct shell *sh, size_t argc, char **argv) {
+    shell_print(sh, "depth %u, max %u of %u per timeline, coalesced taps %u, dropped %u",
+                stats.depth, stats.high_water, TIMELINE_SIZE, stats.coalesced_taps,
+                stats.dropped);
+
+    for (int i = 0; i < TIMELINE_COUNT; i++) {
+        if (timelines[i].len > 0) {
+            shell_print(sh, "  timeline %d: %u queued", i, timelines[i].len);
+        }
+    }
+
+    return 0;
+}
+
+static int cmd_behavior_queue_reset(const struct shell *sh, size_t argc, char **argv) {
+    const uint32_t depth = stats.depth;
+
+    memset(&stats, 0, sizeof(stats));
+    stats.depth = depth;
+
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_behavior_queue,
+                               SHELL_CMD(stats, NULL, "Show behavior queue statistics",
+                                         cmd_behavior_queue_stats),
+                               SHELL_CMD(reset, NULL, "Reset behavior queue statistics",
+                                         cmd_behavior_queue_reset),
+                               SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(behavior_queue, &sub_behavior_queue, "Behavior queue statistics", NULL);
+
+#endif /* IS_ENABLED(CONFIG_SHELL) */
@@ -41,21 +41,30 @@ struct behavior_caps_word_data {
     bool active;
 };
 
+// Number of active caps word instances, so the listener can skip every event while none are active.
+static uint8_t active_caps_word_count;
+
 static void activate_caps_word(const struct device *dev) {
     struct behavior_caps_word_data *data = dev->data;
 
+    if (!data->active) {
+        active_caps_word_count++;
+    }
     data->active = true;
 }
 
 static void deactivate_caps_word(const struct device *dev) {
     struct behavior_caps_word_data *data = dev->data;
 
+    if (data->active) {
+        active_caps_word_count--;
+    }
     data->active = false;
 }
 
 static int on_caps_word_binding_pressed(struct zmk_behavior_binding *binding,
                                         struct zmk_behavior_binding_event event) {
-    const struct device *dev = device_get_binding(binding->behavior_dev);
+    const struct device *dev = zmk_behavior_get_binding_device(binding);
     struct behavior_caps_word_data *data = dev->data;
 
     if (data->active) {
@@ -125,6 +134,10 @@ static void caps_word_enhance_usage(const struct behavior_caps_word_config *conf
 }
 
 static int caps_word_keycode_state_changed_listener(const zmk_event_t *eh) {
+    if (active_caps_word_count == 0) {
+        return ZMK_EV_EVENT_BUBBLE;
+    }
+
     struct zmk_keycode_state_changed *ev = as_zmk_keycode_state_changed(eh);
     if (ev == NULL || !ev->state) {
         return ZMK_EV_EVENT_BUBBLE;
@@ -6,6 +6,7 @@
 
 #define DT_DRV_COMPAT zmk_behavior_hold_tap
 
+#include <string.h>
 #include <zephyr/device.h>
 #include <drivers/behavior.h>
 #include <zmk/keys.h>
@@ -20,12 +21,16 @@
 #include <zmk/behavior.h>
 #include <zmk/keymap.h>
 
+#if IS_ENABLED(CONFIG_SHELL)
+#include <zephyr/shell/shell.h>
+#endif
+
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
 #if DT_HAS_COMPAT_STATUS_OKAY(DT_DRV_COMPAT)
 
-#define ZMK_BHV_HOLD_TAP_MAX_HELD 10
-#define ZMK_BHV_HOLD_TAP_MAX_CAPTURED_EVENTS 40
+#define ZMK_BHV_HOLD_TAP_MAX_HELD CONFIG_ZMK_BEHAVIOR_HOLD_TAP_MAX_HELD
+#define ZMK_BHV_HOLD_TAP_MAX_CAPTURED_EVENTS CONFIG_ZMK_BEHAVIOR_HOLD_TAP_MAX_CAPTURED_EVENTS
 
 // increase if you have keyboard with more keys.
 #define ZMK_BHV_HOLD_TAP_POSITION_NOT_USED 9999
@@ -37,6 +42,8 @@ enum flavor {
     FLAVOR_TAP_UNLESS_INTERRUPTED,
 };
 
+#define FLAVOR_COUNT (FLAVOR_TAP_UNLESS_INTERRUPTED + 1)
+
 enum status {
     STATUS_UNDECIDED,
     STATUS_TAP,
@@ -87,8 +94,31 @@ struct active_hold_tap {
 // its key-up has been processed and the delayed work is cleaned up.
 struct active_hold_tap *undecided_hold_tap = NULL;
 struct active_hold_tap active_hold_taps[ZMK_BHV_HOLD_TAP_MAX_HELD] = {};
+// Number of slots in active_hold_taps which are in use.
+static uint32_t active_hold_tap_count;
 // We capture most position_state_changed events and some modifiers_state_changed events.
+// This is a ring buffer of the events captured by the undecided hold-tap, oldest first. While
+// captured events are being released, the ones still waiting to be released are kept in the same
+// ring after them, past the slots of the events released so far.
 const zmk_event_t *captured_events[ZMK_BHV_HOLD_TAP_MAX_CAPTURED_EVENTS] = {};
+static uint32_t captured_events_head;
+static uint32_t captured_events_len;
+static uint32_t released_slots;
+static uint32_t releasing_events_len;
+// Bitmap of the positions which have a key-down event in captured_events.
+static uint32_t captured_keydowns[DIV_ROUND_UP(ZMK_KEYMAP_LEN, 32)];
+
+struct hold_tap_flavor_stats {
+    uint32_t decisions;
+    uint32_t max_decision_ms;
+    uint64_t total_decision_ms;
+};
+
+static struct {
+    struct hold_tap_flavor_stats flavors[FLAVOR_COUNT];
+    uint32_t max_captured_events;
+    uint32_t capture_overflows;
+} hold_tap_stats;
 
 // Keep track of which key was tapped most recently for the standard, if it is a hold-tap
 // a position, will be given, if not it will just be INT32_MIN
@@ -119,33 +149,54 @@ static bool is_quick_tap(struct active_hold_tap *hold_tap) {
     }
 }
 
+static const zmk_event_t **captured_event_at(uint32_t index) {
+    return &captured_events[(captured_events_head + index) % ZMK_BHV_HOLD_TAP_MAX_CAPTURED_EVENTS];
+}
+
 static int capture_event(const zmk_event_t *event) {
-    for (int i = 0; i < ZMK_BHV_HOLD_TAP_MAX_CAPTURED_EVENTS; i++) {
-        if (captured_events[i] == NULL) {
-            captured_events[i] = event;
-            return 0;
+    if (released_slots > 0) {
+        released_slots--;
+    } else if (captured_events_len + releasing_events_len < ZMK_BHV_HOLD_TAP_MAX_CAPTURED_EVENTS) {
+        // Make room in front of the events still waiting to be released.
+        const uint32_t end = captured_events_len + releasing_events_len;
+        for (uint32_t i = end; i > captured_events_len; i--) {
+            *captured_event_at(i) = *captured_event_at(i - 1);
         }
+    } else {
+        hold_tap_stats.capture_overflows++;
+        return -ENOMEM;
     }
-    return -ENOMEM;
+
+    *captured_event_at(captured_events_len++) = event;
+    hold_tap_stats.max_captured_events =
+        MAX(hold_tap_stats.max_captured_events, captured_events_len);
+
+    const struct zmk_position_state_changed *position_event = as_zmk_position_state_changed(event);
+    if (position_event != NULL && position_event->state &&
+        position_event->position < ZMK_KEYMAP_LEN) {
+        captured_keydowns[position_event->position / 32] |= BIT(position_event->position % 32);
+    }
+
+    return 0;
 }
 
-static struct zmk_position_state_changed *find_captured_keydown_event(uint32_t position) {
-    struct zmk_position_state_changed *last_match = NULL;
-    for (int i = 0; i < ZMK_BHV_HOLD_TAP_MAX_CAPTURED_EVENTS; i++) {
-        const zmk_event_t *eh = captured_events[i];
-        if (eh == NULL) {
-            return last_match;
-        }
-        struct zmk_position_state_changed *position_event = as_zmk_position_state_changed(eh);
-        if (position_event == NULL) {
-            continue;
-        }
+static bool has_captured_keydown_event(uint32_t position) {
+    if (position < ZMK_KEYMAP_LEN) {
+        return captured_keydowns[position / 32] & BIT(position % 32);
+    }
+
+    // Positions outside the keymap aren't in the bitmap, so search for them.
+    for (int i = 0; i < captured_events_len; i++) {
+        const struct zmk_position_state_changed *position_event =
+            as_zmk_position_state_changed(*captured_event_at(i));
 
-        if (position_event->position == position && position_event->state) {
-            last_match = position_event;
+        if (position_event != NULL && position_event->position == position &&
+            position_event->state) {
+            return true;
         }
     }
-    return last_match;
+
+    return false;
 }
 
 const struct zmk_listener zmk_listener_behavior_hold_tap;
@@ -155,37 +206,43 @@ static void release_captured_events() {
         return;
     }
 
-    // We use a trick to prevent copying the captured_events array.
+    // Events are released in place. The events captured by the hold-tap which was just decided
+    // happened before any which are still waiting to be released by an outer call, so they are
+    // moved up against them and released first. A released event may start a new undecided
+    // hold-tap, which then captures the following events into the slots freed before them, so
+    // nothing is copied and events are always raised in order.
     //
-    // Events for different mod-tap instances are separated by a NULL pointer.
-    //
-    // The first event popped will never be catched by the next active hold-tap
-    // because to start capturing a mod-tap-key-down event must first completely
-    // go through the events queue.
-    //
-    // Example of this release process;
-    // [mt2_down, k1_down, k1_up, mt2_up, null, ...]
-    //  ^
+    // Example of this release process:
+    // ring [mt2_down, k1_down, k1_up, mt2_up]
     // mt2_down position event isn't captured because no hold-tap is active.
-    // mt2_down behavior event is handled, now we have an undecided hold-tap
-    // [null, k1_down, k1_up, mt2_up, null, ...]
-    //        ^
-    // k1_down  is captured by the mt2 mod-tap
-    // !note that searches for find_captured_keydown_event by the mt2 behavior will stop at the
-    // first null encountered [mt1_down, null, k1_up, mt2_up, null, ...]
-    //                  ^
-    // k1_up event is captured by the new hold-tap:
-    // [k1_down, k1_up, null, mt2_up, null, ...]
-    //                        ^
-    // mt2_up event is not captured but causes release of mt2 behavior
-    // [k1_down, k1_up, null, null, null, ...]
-    // now mt2 will start releasing it's own captured positions.
-    for (int i = 0; i < ZMK_BHV_HOLD_TAP_MAX_CAPTURED_EVENTS; i++) {
-        const zmk_event_t *captured_event = captured_events[i];
-        if (captured_event == NULL) {
-            return;
+    // mt2_down behavior event is handled, now we have an undecided hold-tap.
+    // k1_down and k1_up are captured by the mt2 hold-tap into the freed slots:
+    // ring [k1_down, k1_up, <free>, mt2_up]
+    // mt2_up event is not captured but causes release of mt2 behavior, which releases k1_down and
+    // k1_up the same way.
+    for (uint32_t i = captured_events_len; i > 0; i--) {
+        *captured_event_at(i - 1 + released_slots) = *captured_event_at(i - 1);
+    }
+
+    captured_events_head =
+        (captured_events_head + released_slots) % ZMK_BHV_HOLD_TAP_MAX_CAPTURED_EVENTS;
+    releasing_events_len += captured_events_len;
+    captured_events_len = 0;
+    released_slots = 0;
+    memset(captured_keydowns, 0, sizeof(captured_keydowns));
+
+    // A hold-tap decided while releasing these releases the rest of them itself.
+    while (releasing_events_len > 0) {
+        const zmk_event_t *captured_event =
+            *captured_event_at(captured_events_len + released_slots);
+
+        // Once nothing is left to release, the freed slots are just free space after the captures.
+        if (--releasing_events_len == 0) {
+            released_slots = 0;
+        } else {
+            released_slots++;
         }
-        captured_events[i] = NULL;
+
         if (undecided_hold_tap != NULL) {
             k_msleep(10);
         }
@@ -226,12 +283,16 @@ static struct active_hold_tap *store_hold_tap(uint32_t position, uint32_t param_
         active_hold_taps[i].param_tap = param_tap;
         active_hold_taps[i].timestamp = timestamp;
         active_hold_taps[i].position_of_first_other_key_pressed = -1;
+        active_hold_tap_count++;
         return &active_hold_taps[i];
     }
     return NULL;
 }
 
 static void clear_hold_tap(struct active_hold_tap *hold_tap) {
+    if (hold_tap->position != ZMK_BHV_HOLD_TAP_POSITION_NOT_USED) {
+        active_hold_tap_count--;
+    }
     hold_tap->position = ZMK_BHV_HOLD_TAP_POSITION_NOT_USED;
     hold_tap->status = STATUS_UNDECIDED;
     hold_tap->work_is_cancelled = false;
@@ -467,6 +528,12 @@ static void decide_hold_tap(struct active_hold_tap *hold_tap,
 
     decide_positional_hold(hold_tap);
 
+    struct hold_tap_flavor_stats *stats = &hold_tap_stats.flavors[hold_tap->config->flavor];
+    const uint32_t decision_ms = MAX(k_uptime_get() - hold_tap->timestamp, 0);
+    stats->decisions++;
+    stats->total_decision_ms += decision_ms;
+    stats->max_decision_ms = MAX(stats->max_decision_ms, decision_ms);
+
     // Since the hold-tap has been decided, clean up undecided_hold_tap and
     // execute the decided behavior.
     LOG_DBG("%d decided %s (%s decision moment %s)", hold_tap->position,
@@ -491,6 +558,10 @@ static void decide_retro_tap(struct active_hold_tap *hold_tap) {
 }
 
 static void update_hold_status_for_retro_tap(uint32_t ignore_position) {
+    if (active_hold_tap_count == 0) {
+        return;
+    }
+
     for (int i = 0; i < ZMK_BHV_HOLD_TAP_MAX_HELD; i++) {
         struct active_hold_tap *hold_tap = &active_hold_taps[i];
         if (hold_tap->position == ignore_position ||
@@ -508,7 +579,7 @@ static void update_hold_status_for_retro_tap(uint32_t ignore_position) {
 
 static int on_hold_tap_binding_pressed(struct zmk_behavior_binding *binding,
                                        struct zmk_behavior_binding_event event) {
-    const struct device *dev = device_get_binding(binding->behavior_dev);
+    const struct device *dev = zmk_behavior_get_binding_device(binding);
     const struct behavior_hold_tap_config *cfg = dev->config;
 
     if (undecided_hold_tap != NULL) {
@@ -619,7 +690,7 @@ static int position_state_changed_listener(const zmk_event_t *eh) {
         return ZMK_EV_EVENT_BUBBLE;
     }
 
-    if (!ev->state && find_captured_keydown_event(ev->position) == NULL) {
+    if (!ev->state && !has_captured_keydown_event(ev->position)) {
         // no keydown event has been captured, let it bubble.
         // we'll catch modifiers later in modifier_state_changed_listener
         LOG_DBG("%d bubbling %d %s event", undecided_hold_tap->position, ev->position,
@@ -627,9 +698,18 @@ static int position_state_changed_listener(const zmk_event_t *eh) {
         return ZMK_EV_EVENT_BUBBLE;
     }
 
+    if (capture_event(eh) != 0) {
+        // Bubbling the event would handle it ahead of the captured ones, which can leave a key
+        // stuck down. Decide now so the captured events are released first, then handle this one
+        // as if it had just arrived.
+        LOG_WRN("%d capture queue full, deciding before %d %s event", undecided_hold_tap->position,
+                ev->position, ev->state ? "down" : "up");
+        decide_hold_tap(undecided_hold_tap, HT_TIMER_EVENT);
+        return position_state_changed_listener(eh);
+    }
+
     LOG_DBG("%d capturing %d %s event", undecided_hold_tap->position, ev->position,
             ev->state ? "down" : "up");
-    capture_event(eh);
     decide_hold_tap(undecided_hold_tap, ev->state ? HT_OTHER_KEY_DOWN : HT_OTHER_KEY_UP);
     return ZMK_EV_EVENT_CAPTURED;
 }
@@ -654,9 +734,16 @@ static int keycode_state_changed_listener(const zmk_event_t *eh) {
 
     // only key-up events will bubble through position_state_changed_listener
     // if a undecided_hold_tap is active.
+    if (capture_event(eh) != 0) {
+        // As for position events, release the captured events before this one.
+        LOG_WRN("%d capture queue full, deciding before 0x%02X %s event",
+                undecided_hold_tap->position, ev->keycode, ev->state ? "down" : "up");
+        decide_hold_tap(undecided_hold_tap, HT_TIMER_EVENT);
+        return keycode_state_changed_listener(eh);
+    }
+
     LOG_DBG("%d capturing 0x%02X %s event", undecided_hold_tap->position, ev->keycode,
             ev->state ? "down" : "up");
-    capture_event(eh);
     return ZMK_EV_EVENT_CAPTURED;
 }
 
@@ -684,6 +771,43 @@ void behavior_hold_tap_timer_work_handler(struct k_work *item) {
     }
 }
 
+#if IS_ENABLED(CONFIG_SHELL)
+
+static int cmd_hold_tap_stats(const struct shell *sh, size_t argc, char **argv) {
+    shell_print(sh, "%-24s %9s %9s %9s", "flavor", "decisions", "avg ms", "max ms");
+
+    for (int i = 0; i < FLAVOR_COUNT; i++) {
+        const struct hold_tap_flavor_stats *stats = &hold_tap_stats.flavors[i];
+
+        shell_print(sh, "%-24s %9u %9u %9u", flavor_str(i), stats->decisions,
+                    stats->decisions > 0 ? (uint32_t)(stats->total_decision_ms / stats->decisions)
+                                         : 0,
+                    stats->max_decision_ms);
+    }
+
+    shell_print(sh, "captured events: %u now, %u max of %u, %u overflows", captured_events_len,
+                hold_tap_stats.max_captured_events, ZMK_BHV_HOLD_TAP_MAX_CAPTURED_EVENTS,
+                hold_tap_stats.capture_overflows);
+
+    return 0;
+}
+
+static int cmd_hold_tap_reset(const struct shell *sh, size_t argc, char **argv) {
+    memset(&hold_tap_stats, 0, sizeof(hold_tap_stats));
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_hold_tap,
+                               SHELL_CMD(stats, NULL, "Show hold-tap decision statistics",
+                                         cmd_hold_tap_stats),
+                               SHELL_CMD(reset, NULL, "Reset hold-tap statistics",
+                                         cmd_hold_tap_reset),
+                               SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(hold_tap, &sub_hold_tap, "Hold-tap statistics", NULL);
+
+#endif /* IS_ENABLED(CONFIG_SHELL) */
+
 static int behavior_hold_tap_init(const struct device *dev) {
     static bool init_first_run = true;
 
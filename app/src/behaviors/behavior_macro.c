@@ -5,10 +5,11 @@
  */
 
 #include <zephyr/device.h>
+#include <zephyr/init.h>
+#include <zephyr/kernel.h>
 #include <drivers/behavior.h>
 #include <zephyr/logging/log.h>
 #include <zmk/behavior.h>
-#include <zmk/behavior_queue.h>
 #include <zmk/keymap.h>
 
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
@@ -21,194 +22,186 @@ enum behavior_macro_mode {
 
 enum param_source { PARAM_SOURCE_BINDING, PARAM_SOURCE_MACRO_1ST, PARAM_SOURCE_MACRO_2ND };
 
-struct behavior_macro_trigger_state {
-    uint32_t wait_ms;
+// Macro control bindings have no device of their own. They are identified by their compatible at
+// build time, and folded into the steps which follow them when the macro is compiled.
+enum behavior_macro_control {
+    MACRO_CONTROL_NONE,
+    MACRO_CONTROL_MODE_TAP,
+    MACRO_CONTROL_MODE_PRESS,
+    MACRO_CONTROL_MODE_RELEASE,
+    MACRO_CONTROL_TAP_TIME,
+    MACRO_CONTROL_WAIT_TIME,
+    MACRO_CONTROL_PAUSE_FOR_RELEASE,
+    MACRO_CONTROL_PARAM_1TO1,
+    MACRO_CONTROL_PARAM_1TO2,
+    MACRO_CONTROL_PARAM_2TO1,
+    MACRO_CONTROL_PARAM_2TO2,
+};
+
+// One invokable binding of a macro, with the mode, timing and parameter sources that the control
+// bindings before it selected.
+struct behavior_macro_op {
+    struct zmk_behavior_binding binding;
     uint32_t tap_ms;
-    enum behavior_macro_mode mode;
-    uint16_t start_index;
-    uint16_t count;
-    enum param_source param1_source;
-    enum param_source param2_source;
+    uint32_t wait_ms;
+    uint8_t mode;
+    uint8_t param1_source;
+    uint8_t param2_source;
 };
 
 struct behavior_macro_state {
-    struct behavior_macro_trigger_state release_state;
-
-    uint32_t press_bindings_count;
+    struct behavior_macro_op *ops;
+    uint16_t ops_count;
+    // Ops before this index run on press, the rest run on release.
+    uint16_t press_ops_count;
 };
 
 struct behavior_macro_config {
     uint32_t default_wait_ms;
     uint32_t default_tap_ms;
     uint32_t count;
+    const uint8_t *controls;
     struct zmk_behavior_binding bindings[];
 };
 
-#define TAP_MODE DT_PROP(DT_INST(0, zmk_macro_control_mode_tap), label)
-#define PRESS_MODE DT_PROP(DT_INST(0, zmk_macro_control_mode_press), label)
-#define REL_MODE DT_PROP(DT_INST(0, zmk_macro_control_mode_release), label)
-
-#define TAP_TIME DT_PROP(DT_INST(0, zmk_macro_control_tap_time), label)
-#define WAIT_TIME DT_PROP(DT_INST(0, zmk_macro_control_wait_time), label)
-#define WAIT_REL DT_PROP(DT_INST(0, zmk_macro_pause_for_release), label)
-
-#define P1TO1 DT_PROP(DT_INST(0, zmk_macro_param_1to1), label)
-#define P1TO2 DT_PROP(DT_INST(0, zmk_macro_param_1to2), label)
-#define P2TO1 DT_PROP(DT_INST(0, zmk_macro_param_2to1), label)
-#define P2TO2 DT_PROP(DT_INST(0, zmk_macro_param_2to2), label)
-
-#define ZM_IS_NODE_MATCH(a, b) (strcmp(a, b) == 0)
-#define IS_TAP_MODE(dev) ZM_IS_NODE_MATCH(dev, TAP_MODE)
-#define IS_PRESS_MODE(dev) ZM_IS_NODE_MATCH(dev, PRESS_MODE)
-#define IS_RELEASE_MODE(dev) ZM_IS_NODE_MATCH(dev, REL_MODE)
-
-#define IS_TAP_TIME(dev) ZM_IS_NODE_MATCH(dev, TAP_TIME)
-#define IS_WAIT_TIME(dev) ZM_IS_NODE_MATCH(dev, WAIT_TIME)
-#define IS_PAUSE(dev) ZM_IS_NODE_MATCH(dev, WAIT_REL)
-
-#define IS_P1TO1(dev) ZM_IS_NODE_MATCH(dev, P1TO1)
-#define IS_P1TO2(dev) ZM_IS_NODE_MATCH(dev, P1TO2)
-#define IS_P2TO1(dev) ZM_IS_NODE_MATCH(dev, P2TO1)
-#define IS_P2TO2(dev) ZM_IS_NODE_MATCH(dev, P2TO2)
-
-static bool handle_control_binding(struct behavior_macro_trigger_state *state,
-                                   const struct zmk_behavior_binding *binding) {
-    if (IS_TAP_MODE(binding->behavior_dev)) {
-        state->mode = MACRO_MODE_TAP;
-        LOG_DBG("macro mode set: tap");
-    } else if (IS_PRESS_MODE(binding->behavior_dev)) {
-        state->mode = MACRO_MODE_PRESS;
-        LOG_DBG("macro mode set: press");
-    } else if (IS_RELEASE_MODE(binding->behavior_dev)) {
-        state->mode = MACRO_MODE_RELEASE;
-        LOG_DBG("macro mode set: release");
-    } else if (IS_TAP_TIME(binding->behavior_dev)) {
-        state->tap_ms = binding->param1;
-        LOG_DBG("macro tap time set: %d", state->tap_ms);
-    } else if (IS_WAIT_TIME(binding->behavior_dev)) {
-        state->wait_ms = binding->param1;
-        LOG_DBG("macro wait time set: %d", state->wait_ms);
-    } else if (IS_P1TO1(binding->behavior_dev)) {
-        state->param1_source = PARAM_SOURCE_MACRO_1ST;
-        LOG_DBG("macro param: 1to1");
-    } else if (IS_P1TO2(binding->behavior_dev)) {
-        state->param2_source = PARAM_SOURCE_MACRO_1ST;
-        LOG_DBG("macro param: 1to2");
-    } else if (IS_P2TO1(binding->behavior_dev)) {
-        state->param1_source = PARAM_SOURCE_MACRO_2ND;
-        LOG_DBG("macro param: 2to1");
-    } else if (IS_P2TO2(binding->behavior_dev)) {
-        state->param2_source = PARAM_SOURCE_MACRO_2ND;
-        LOG_DBG("macro param: 2to2");
-    } else {
-        return false;
-    }
+// A press or release of a macro which is waiting to run or running.
+struct behavior_macro_run {
+    const struct behavior_macro_op *ops;
+    uint16_t index;
+    uint16_t end;
+    uint32_t position;
+    uint32_t param1;
+    uint32_t param2;
+    // Set between the press and release of a tap mode op.
+    bool tap_pressed;
+};
 
-    return true;
-}
+// Every macro shares this one queue and runs to completion before the next one starts, so the text
+// typed by two macros is never interleaved. A long macro does hold up every other macro.
+K_MSGQ_DEFINE(behavior_macro_runs, sizeof(struct behavior_macro_run), CONFIG_ZMK_MACRO_QUEUE_SIZE,
+              4);
 
-static int behavior_macro_init(const struct device *dev) {
-    const struct behavior_macro_config *cfg = dev->config;
-    struct behavior_macro_state *state = dev->data;
-    state->press_bindings_count = cfg->count;
-    state->release_state.start_index = cfg->count;
-    state->release_state.count = 0;
+static struct behavior_macro_run current_run;
+static bool run_active;
 
-    LOG_DBG("Precalculate initial release state:");
-    for (int i = 0; i < cfg->count; i++) {
-        if (handle_control_binding(&state->release_state, &cfg->bindings[i])) {
-            // Updated state used for initial state on release.
-        } else if (IS_PAUSE(cfg->bindings[i].behavior_dev)) {
-            state->release_state.start_index = i + 1;
-            state->release_state.count = cfg->count - state->release_state.start_index;
-            state->press_bindings_count = i;
-            LOG_DBG("Release will resume at %d", state->release_state.start_index);
-            break;
-        } else {
-            // Ignore regular invokable bindings
-        }
-    }
-
-    return 0;
-};
+static void behavior_macro_process_next(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(run_work, behavior_macro_process_next);
 
 static uint32_t select_param(enum param_source param_source, uint32_t source_binding,
-                             const struct zmk_behavior_binding *macro_binding) {
+                             const struct behavior_macro_run *run) {
     switch (param_source) {
     case PARAM_SOURCE_MACRO_1ST:
-        return macro_binding->param1;
+        return run->param1;
     case PARAM_SOURCE_MACRO_2ND:
-        return macro_binding->param2;
+        return run->param2;
     default:
         return source_binding;
     }
 };
 
-static void replace_params(struct behavior_macro_trigger_state *state,
-                           struct zmk_behavior_binding *binding,
-                           const struct zmk_behavior_binding *macro_binding) {
-    binding->param1 = select_param(state->param1_source, binding->param1, macro_binding);
-    binding->param2 = select_param(state->param2_source, binding->param2, macro_binding);
+// Runs queued macro ops until one has to wait, one op at a time, so a macro takes a single queue
+// entry however long it is.
+static void behavior_macro_process_next(struct k_work *work) {
+    while (true) {
+        if (!run_active) {
+            if (k_msgq_get(&behavior_macro_runs, &current_run, K_NO_WAIT) != 0) {
+                return;
+            }
 
-    state->param1_source = PARAM_SOURCE_BINDING;
-    state->param2_source = PARAM_SOURCE_BINDING;
-}
+            run_active = true;
+        }
 
-static void queue_macro(uint32_t position, const struct zmk_behavior_binding bindings[],
-                        struct behavior_macro_trigger_state state,
-                        const struct zmk_behavior_binding *macro_binding) {
-    LOG_DBG("Iterating macro bindings - starting: %d, count: %d", state.start_index, state.count);
-    for (int i = state.start_index; i < state.start_index + state.count; i++) {
-        if (!handle_control_binding(&state, &bindings[i])) {
-            struct zmk_behavior_binding binding = bindings[i];
-            replace_params(&state, &binding, macro_binding);
-
-            switch (state.mode) {
-            case MACRO_MODE_TAP:
-                zmk_behavior_queue_add(position, binding, true, state.tap_ms);
-                zmk_behavior_queue_add(position, binding, false, state.wait_ms);
-                break;
-            case MACRO_MODE_PRESS:
-                zmk_behavior_queue_add(position, binding, true, state.wait_ms);
-                break;
-            case MACRO_MODE_RELEASE:
-                zmk_behavior_queue_add(position, binding, false, state.wait_ms);
-                break;
-            default:
-                LOG_ERR("Unknown macro mode: %d", state.mode);
-                break;
+        if (current_run.index >= current_run.end) {
+            run_active = false;
+            continue;
+        }
+
+        const struct behavior_macro_op *op = &current_run.ops[current_run.index];
+        struct zmk_behavior_binding binding = op->binding;
+        binding.param1 = select_param(op->param1_source, binding.param1, &current_run);
+        binding.param2 = select_param(op->param2_source, binding.param2, &current_run);
+
+        struct zmk_behavior_binding_event event = {.position = current_run.position,
+                                                   .timestamp = k_uptime_get()};
+
+        LOG_DBG("Invoking %s: 0x%02x 0x%02x", binding.behavior_dev, binding.param1,
+                binding.param2);
+
+        uint32_t wait_ms;
+        if (op->mode == MACRO_MODE_TAP && !current_run.tap_pressed) {
+            behavior_keymap_binding_pressed(&binding, event);
+            current_run.tap_pressed = true;
+            wait_ms = op->tap_ms;
+        } else {
+            if (op->mode == MACRO_MODE_PRESS) {
+                behavior_keymap_binding_pressed(&binding, event);
+            } else {
+                behavior_keymap_binding_released(&binding, event);
             }
+            current_run.tap_pressed = false;
+            current_run.index++;
+            wait_ms = op->wait_ms;
         }
+
+        LOG_DBG("Processing next macro op in %dms", wait_ms);
+
+        if (wait_ms > 0) {
+            k_work_schedule(&run_work, K_MSEC(wait_ms));
+            return;
+        }
+    }
+}
+
+static void queue_macro(uint32_t position, const struct behavior_macro_op *ops, uint16_t start,
+                        uint16_t end, const struct zmk_behavior_binding *macro_binding) {
+    LOG_DBG("Queueing macro ops - starting: %d, count: %d", start, end - start);
+    if (start >= end) {
+        return;
+    }
+
+    struct behavior_macro_run run = {
+        .ops = ops,
+        .index = start,
+        .end = end,
+        .position = position,
+        .param1 = macro_binding->param1,
+        .param2 = macro_binding->param2,
+    };
+
+    if (k_msgq_put(&behavior_macro_runs, &run, K_NO_WAIT) != 0) {
+        LOG_ERR("Macro queue is full, dropping %s", macro_binding->behavior_dev);
+        return;
+    }
+
+    // Start straight away unless another macro is running or waiting. Macros invoked by a running
+    // macro run after it.
+    if (!run_active && !k_work_delayable_is_pending(&run_work)) {
+        behavior_macro_process_next(&run_work.work);
     }
 }
 
 static int on_macro_binding_pressed(struct zmk_behavior_binding *binding,
                                     struct zmk_behavior_binding_event event) {
-    const struct device *dev = device_get_binding(binding->behavior_dev);
-    const struct behavior_macro_config *cfg = dev->config;
-    struct behavior_macro_state *state = dev->data;
-    struct behavior_macro_trigger_state trigger_state = {.mode = MACRO_MODE_TAP,
-                                                         .tap_ms = cfg->default_tap_ms,
-                                                         .wait_ms = cfg->default_wait_ms,
-                                                         .start_index = 0,
-                                                         .count = state->press_bindings_count};
+    const struct device *dev = zmk_behavior_get_binding_device(binding);
+    const struct behavior_macro_state *state = dev->data;
 
-    queue_macro(event.position, cfg->bindings, trigger_state, binding);
+    queue_macro(event.position, state->ops, 0, state->press_ops_count, binding);
 
     return ZMK_BEHAVIOR_OPAQUE;
 }
 
 static int on_macro_binding_released(struct zmk_behavior_binding *binding,
                                      struct zmk_behavior_binding_event event) {
-    const struct device *dev = device_get_binding(binding->behavior_dev);
-    const struct behavior_macro_config *cfg = dev->config;
-    struct behavior_macro_state *state = dev->data;
+    const struct device *dev = zmk_behavior_get_binding_device(binding);
+    const struct behavior_macro_state *state = dev->data;
 
-    queue_macro(event.position, cfg->bindings, state->release_state, binding);
+    queue_macro(event.position, state->ops, state->press_ops_count, state->ops_count, binding);
 
     return ZMK_BEHAVIOR_OPAQUE;
 }
 
+static int behavior_macro_init(const struct device *dev) { return 0; };
+
 static const struct behavior_driver_api behavior_macro_driver_api = {
     .binding_pressed = on_macro_binding_pressed,
     .binding_released = on_macro_binding_released,
@@ -217,12 +210,33 @@ static const struct behavior_driver_api behavior_macro_driver_api = {
 #define TRANSFORMED_BEHAVIORS(n)                                                                   \
     {LISTIFY(DT_PROP_LEN(n, bindings), ZMK_KEYMAP_EXTRACT_BINDING, (, ), n)},
 
+#define MACRO_CONTROL(node)                                                                        \
+    (DT_NODE_HAS_COMPAT(node, zmk_macro_control_mode_tap) ? MACRO_CONTROL_MODE_TAP                 \
+     : DT_NODE_HAS_COMPAT(node, zmk_macro_control_mode_press) ? MACRO_CONTROL_MODE_PRESS           \
+     : DT_NODE_HAS_COMPAT(node, zmk_macro_control_mode_release) ? MACRO_CONTROL_MODE_RELEASE       \
+     : DT_NODE_HAS_COMPAT(node, zmk_macro_control_tap_time) ? MACRO_CONTROL_TAP_TIME               \
+     : DT_NODE_HAS_COMPAT(node, zmk_macro_control_wait_time) ? MACRO_CONTROL_WAIT_TIME             \
+     : DT_NODE_HAS_COMPAT(node, zmk_macro_pause_for_release) ? MACRO_CONTROL_PAUSE_FOR_RELEASE     \
+     : DT_NODE_HAS_COMPAT(node, zmk_macro_param_1to1) ? MACRO_CONTROL_PARAM_1TO1                   \
+     : DT_NODE_HAS_COMPAT(node, zmk_macro_param_1to2) ? MACRO_CONTROL_PARAM_1TO2                   \
+     : DT_NODE_HAS_COMPAT(node, zmk_macro_param_2to1) ? MACRO_CONTROL_PARAM_2TO1                   \
+     : DT_NODE_HAS_COMPAT(node, zmk_macro_param_2to2) ? MACRO_CONTROL_PARAM_2TO2                   \
+     : MACRO_CONTROL_NONE)
+
+#define MACRO_CONTROL_BY_IDX(idx, n) MACRO_CONTROL(DT_PHANDLE_BY_IDX(n, bindings, idx))
+
 #define MACRO_INST(inst)                                                                           \
-    static struct behavior_macro_state behavior_macro_state_##inst = {};                           \
+    static const uint8_t behavior_macro_controls_##inst[] = {                                      \
+        LISTIFY(DT_PROP_LEN(inst, bindings), MACRO_CONTROL_BY_IDX, (, ), inst)};                   \
+    static struct behavior_macro_op behavior_macro_ops_##inst[DT_PROP_LEN(inst, bindings)];        \
+    static struct behavior_macro_state behavior_macro_state_##inst = {                             \
+        .ops = behavior_macro_ops_##inst,                                                          \
+    };                                                                                             \
     static struct behavior_macro_config behavior_macro_config_##inst = {                           \
         .default_wait_ms = DT_PROP_OR(inst, wait_ms, CONFIG_ZMK_MACRO_DEFAULT_WAIT_MS),            \
         .default_tap_ms = DT_PROP_OR(inst, tap_ms, CONFIG_ZMK_MACRO_DEFAULT_TAP_MS),               \
         .count = DT_PROP_LEN(inst, bindings),                                                      \
+        .controls = behavior_macro_controls_##inst,                                                \
         .bindings = TRANSFORMED_BEHAVIORS(inst)};                                                  \
     DEVICE_DT_DEFINE(inst, behavior_macro_init, NULL, &behavior_macro_state_##inst,                \
                      &behavior_macro_config_##inst, APPLICATION,                                   \
@@ -231,3 +245,107 @@ static const struct behavior_driver_api behavior_macro_driver_api = {
 DT_FOREACH_STATUS_OKAY(zmk_behavior_macro, MACRO_INST)
 DT_FOREACH_STATUS_OKAY(zmk_behavior_macro_one_param, MACRO_INST)
 DT_FOREACH_STATUS_OKAY(zmk_behavior_macro_two_param, MACRO_INST)
+
+static void behavior_macro_compile(const struct device *dev) {
+    const struct behavior_macro_config *cfg = dev->config;
+    struct behavior_macro_state *state = dev->data;
+    struct behavior_macro_op next = {
+        .mode = MACRO_MODE_TAP,
+        .tap_ms = cfg->default_tap_ms,
+        .wait_ms = cfg->default_wait_ms,
+        .param1_source = PARAM_SOURCE_BINDING,
+        .param2_source = PARAM_SOURCE_BINDING,
+    };
+    // The ops after a pause for release start from the timing set by control bindings before it,
+    // not from the macro's default timing.
+    uint32_t release_tap_ms = 0;
+    uint32_t release_wait_ms = 0;
+    bool paused = false;
+
+    state->ops_count = 0;
+
+    for (int i = 0; i < cfg->count; i++) {
+        const struct zmk_behavior_binding *binding = &cfg->bindings[i];
+
+        switch (cfg->controls[i]) {
+        case MACRO_CONTROL_MODE_TAP:
+            next.mode = MACRO_MODE_TAP;
+            break;
+        case MACRO_CONTROL_MODE_PRESS:
+            next.mode = MACRO_MODE_PRESS;
+            break;
+        case MACRO_CONTROL_MODE_RELEASE:
+            next.mode = MACRO_MODE_RELEASE;
+            break;
+        case MACRO_CONTROL_TAP_TIME:
+            next.tap_ms = binding->param1;
+            release_tap_ms = binding->param1;
+            break;
+        case MACRO_CONTROL_WAIT_TIME:
+            next.wait_ms = binding->param1;
+            release_wait_ms = binding->param1;
+            break;
+        case MACRO_CONTROL_PARAM_1TO1:
+            next.param1_source = PARAM_SOURCE_MACRO_1ST;
+            break;
+        case MACRO_CONTROL_PARAM_1TO2:
+            next.param2_source = PARAM_SOURCE_MACRO_1ST;
+            break;
+        case MACRO_CONTROL_PARAM_2TO1:
+            next.param1_source = PARAM_SOURCE_MACRO_2ND;
+            break;
+        case MACRO_CONTROL_PARAM_2TO2:
+            next.param2_source = PARAM_SOURCE_MACRO_2ND;
+            break;
+        case MACRO_CONTROL_PAUSE_FOR_RELEASE:
+            if (paused) {
+                LOG_WRN("%s: ignoring extra pause for release", dev->name);
+                break;
+            }
+            paused = true;
+            state->press_ops_count = state->ops_count;
+            next.tap_ms = release_tap_ms;
+            next.wait_ms = release_wait_ms;
+            break;
+        default: {
+            struct behavior_macro_op *op = &state->ops[state->ops_count++];
+            *op = next;
+            op->binding = *binding;
+            op->binding.behavior = device_get_binding(binding->behavior_dev);
+            if (op->binding.behavior == NULL) {
+                LOG_ERR("%s: unknown behavior %s", dev->name, binding->behavior_dev);
+            }
+
+            next.param1_source = PARAM_SOURCE_BINDING;
+            next.param2_source = PARAM_SOURCE_BINDING;
+            break;
+        }
+        }
+    }
+
+    if (!paused) {
+        state->press_ops_count = state->ops_count;
+    }
+
+    LOG_DBG("%s: %d ops, release resumes at %d", dev->name, state->ops_count,
+            state->press_ops_count);
+}
+
+#define MACRO_DEVICE(inst) DEVICE_DT_GET(inst),
+
+static const struct device *const macro_devices[] = {
+    DT_FOREACH_STATUS_OKAY(zmk_behavior_macro, MACRO_DEVICE)
+        DT_FOREACH_STATUS_OKAY(zmk_behavior_macro_one_param, MACRO_DEVICE)
+            DT_FOREACH_STATUS_OKAY(zmk_behavior_macro_two_param, MACRO_DEVICE)};
+
+// Compile every macro once its behaviors have been initialized, since device_get_binding() only
+// returns devices which are ready.
+static int behavior_macro_compile_all(const struct device *_arg) {
+    for (int i = 0; i < ARRAY_SIZE(macro_devices); i++) {
+        behavior_macro_compile(macro_devices[i]);
+    }
+
+    return 0;
+}
+
+SYS_INIT(behavior_macro_compile_all, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
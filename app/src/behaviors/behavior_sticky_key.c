@@ -51,6 +51,12 @@ struct active_sticky_key {
 };
 
 struct active_sticky_key active_sticky_keys[ZMK_BHV_STICKY_KEY_MAX_HELD] = {};
+// Number of slots in active_sticky_keys which are in use, so the listener can skip every event
+// while no sticky key is active.
+static uint8_t active_sticky_key_count;
+
+// Sticky keys bound to &kp ignore the key press they generate themselves.
+#define KEY_PRESS_DEVICE DEVICE_DT_GET_ANY(zmk_behavior_key_press)
 
 static struct active_sticky_key *store_sticky_key(uint32_t position, uint32_t param1,
                                                   uint32_t param2,
@@ -70,12 +76,16 @@ static struct active_sticky_key *store_sticky_key(uint32_t position, uint32_t pa
         sticky_key->timer_started = false;
         sticky_key->modified_key_usage_page = 0;
         sticky_key->modified_key_keycode = 0;
+        active_sticky_key_count++;
         return sticky_key;
     }
     return NULL;
 }
 
 static void clear_sticky_key(struct active_sticky_key *sticky_key) {
+    if (sticky_key->position != ZMK_BHV_STICKY_KEY_POSITION_FREE) {
+        active_sticky_key_count--;
+    }
     sticky_key->position = ZMK_BHV_STICKY_KEY_POSITION_FREE;
 }
 
@@ -92,6 +102,7 @@ static inline int press_sticky_key_behavior(struct active_sticky_key *sticky_key
                                             int64_t timestamp) {
     struct zmk_behavior_binding binding = {
         .behavior_dev = sticky_key->config->behavior.behavior_dev,
+        .behavior = sticky_key->config->behavior.behavior,
         .param1 = sticky_key->param1,
         .param2 = sticky_key->param2,
     };
@@ -106,6 +117,7 @@ static inline int release_sticky_key_behavior(struct active_sticky_key *sticky_k
                                               int64_t timestamp) {
     struct zmk_behavior_binding binding = {
         .behavior_dev = sticky_key->config->behavior.behavior_dev,
+        .behavior = sticky_key->config->behavior.behavior,
         .param1 = sticky_key->param1,
         .param2 = sticky_key->param2,
     };
@@ -129,7 +141,7 @@ static int stop_timer(struct active_sticky_key *sticky_key) {
 
 static int on_sticky_key_binding_pressed(struct zmk_behavior_binding *binding,
                                          struct zmk_behavior_binding_event event) {
-    const struct device *dev = device_get_binding(binding->behavior_dev);
+    const struct device *dev = zmk_behavior_get_binding_device(binding);
     const struct behavior_sticky_key_config *cfg = dev->config;
     struct active_sticky_key *sticky_key;
     sticky_key = find_sticky_key(event.position);
@@ -184,6 +196,10 @@ ZMK_LISTENER(behavior_sticky_key, sticky_key_keycode_state_changed_listener);
 ZMK_SUBSCRIPTION(behavior_sticky_key, zmk_keycode_state_changed);
 
 static int sticky_key_keycode_state_changed_listener(const zmk_event_t *eh) {
+    if (active_sticky_key_count == 0) {
+        return ZMK_EV_EVENT_BUBBLE;
+    }
+
     struct zmk_keycode_state_changed *ev = as_zmk_keycode_state_changed(eh);
     if (ev == NULL) {
         return ZMK_EV_EVENT_BUBBLE;
@@ -202,7 +218,7 @@ static int sticky_key_keycode_state_changed_listener(const zmk_event_t *eh) {
             continue;
         }
 
-        if (strcmp(sticky_key->config->behavior.behavior_dev, "KEY_PRESS") == 0 &&
+        if (sticky_key->config->behavior.behavior == KEY_PRESS_DEVICE &&
             ZMK_HID_USAGE_ID(sticky_key->param1) == ev_copy.keycode &&
             ZMK_HID_USAGE_PAGE(sticky_key->param1) == ev_copy.usage_page &&
             SELECT_MODS(sticky_key->param1) == ev_copy.implicit_modifiers) {
@@ -288,7 +304,11 @@ static struct behavior_sticky_key_data behavior_sticky_key_data;
 
 #define KP_INST(n)                                                                                 \
     static struct behavior_sticky_key_config behavior_sticky_key_config_##n = {                    \
-        .behavior = ZMK_KEYMAP_EXTRACT_BINDING(0, DT_DRV_INST(n)),                                 \
+        .behavior =                                                                                \
+            {                                                                                      \
+                .behavior_dev = DT_PROP(DT_INST_PHANDLE_BY_IDX(n, bindings, 0), label),            \
+                .behavior = DEVICE_DT_GET(DT_INST_PHANDLE_BY_IDX(n, bindings, 0)),                 \
+            },                                                                                     \
         .release_after_ms = DT_INST_PROP(n, release_after_ms),                                     \
         .ignore_modifiers = DT_INST_PROP(n, ignore_modifiers),                                     \
         .quick_release = DT_INST_PROP(n, quick_release),                                           \
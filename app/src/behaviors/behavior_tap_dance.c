@@ -49,6 +49,9 @@ struct active_tap_dance {
 };
 
 struct active_tap_dance active_tap_dances[ZMK_BHV_TAP_DANCE_MAX_HELD] = {};
+// Number of slots in active_tap_dances which are in use, so the listener can skip every event
+// while no tap dance is active.
+static uint8_t active_tap_dance_count;
 
 static struct active_tap_dance *find_tap_dance(uint32_t position) {
     for (int i = 0; i < ZMK_BHV_TAP_DANCE_MAX_HELD; i++) {
@@ -72,6 +75,7 @@ static int new_tap_dance(uint32_t position, const struct behavior_tap_dance_conf
             ref_dance->timer_started = true;
             ref_dance->timer_cancelled = false;
             ref_dance->tap_dance_decided = false;
+            active_tap_dance_count++;
             *tap_dance = ref_dance;
             return 0;
         }
@@ -80,6 +84,9 @@ static int new_tap_dance(uint32_t position, const struct behavior_tap_dance_conf
 }
 
 static void clear_tap_dance(struct active_tap_dance *tap_dance) {
+    if (tap_dance->position != ZMK_BHV_TAP_DANCE_POSITION_FREE) {
+        active_tap_dance_count--;
+    }
     tap_dance->position = ZMK_BHV_TAP_DANCE_POSITION_FREE;
 }
 
@@ -125,7 +132,7 @@ static inline int release_tap_dance_behavior(struct active_tap_dance *tap_dance,
 
 static int on_tap_dance_binding_pressed(struct zmk_behavior_binding *binding,
                                         struct zmk_behavior_binding_event event) {
-    const struct device *dev = device_get_binding(binding->behavior_dev);
+    const struct device *dev = zmk_behavior_get_binding_device(binding);
     const struct behavior_tap_dance_config *cfg = dev->config;
     struct active_tap_dance *tap_dance;
     tap_dance = find_tap_dance(event.position);
@@ -195,6 +202,10 @@ ZMK_LISTENER(behavior_tap_dance, tap_dance_position_state_changed_listener);
 ZMK_SUBSCRIPTION(behavior_tap_dance, zmk_position_state_changed);
 
 static int tap_dance_position_state_changed_listener(const zmk_event_t *eh) {
+    if (active_tap_dance_count == 0) {
+        return ZMK_EV_EVENT_BUBBLE;
+    }
+
     struct zmk_position_state_changed *ev = as_zmk_position_state_changed(eh);
     if (ev == NULL) {
         return ZMK_EV_EVENT_BUBBLE;
@@ -230,7 +241,7 @@ static int behavior_tap_dance_init(const struct device *dev) {
         for (int i = 0; i < ZMK_BHV_TAP_DANCE_MAX_HELD; i++) {
             k_work_init_delayable(&active_tap_dances[i].release_timer,
                                   behavior_tap_dance_timer_handler);
-            clear_tap_dance(&active_tap_dances[i]);
+            active_tap_dances[i].position = ZMK_BHV_TAP_DANCE_POSITION_FREE;
         }
     }
     init_first_run = false;
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2023 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include <zephyr/device.h>
+#include <zephyr/init.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/sys/sys_heap.h>
+
+#include <zmk/event_manager.h>
+#include <zmk/events/keycode_state_changed.h>
+#include <zmk/events/position_state_changed.h>
+
+// Every kscan event replayed by the mock driver is one key change fed into the pipeline.
+#define KSCAN_EVENT_COUNT DT_PROP_LEN(DT_CHOSEN(zmk_kscan), events)
+
+extern struct zmk_event_type *__event_type_start[];
+extern struct zmk_event_type *__event_type_end[];
+
+#if CONFIG_HEAP_MEM_POOL_SIZE > 0
+extern struct k_heap _system_heap;
+#endif
+
+static uint64_t start_ns;
+static uint32_t keycode_event_count;
+
+// native_posix time is simulated and doesn't advance while code runs, so measure host CPU time.
+static uint64_t cpu_time_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void report_event_pools() {
+#if IS_ENABLED(CONFIG_ZMK_EVENT_POOL)
+    uint32_t heap_allocations = 0;
+
+    printk("max events in flight (pool size %d):\n", CONFIG_ZMK_EVENT_POOL_SIZE);
+    for (struct zmk_event_type **type = __event_type_start; type < __event_type_end; type++) {
+        const struct zmk_event_pool *pool = (*type)->pool;
+        if (pool->high_water_mark == 0) {
+            continue;
+        }
+
+        printk("  %s: %d\n", (*type)->name, pool->high_water_mark);
+        heap_allocations += pool->exhausted_count;
+    }
+
+    printk("events allocated from the heap: %d\n", heap_allocations);
+#else
+    printk("events are allocated from the heap (CONFIG_ZMK_EVENT_POOL is disabled)\n");
+#endif
+}
+
+static void report_heap() {
+#if CONFIG_HEAP_MEM_POOL_SIZE > 0
+    struct sys_memory_stats stats;
+    if (sys_heap_runtime_stats_get(&_system_heap.heap, &stats) == 0) {
+        printk("heap: %d bytes max allocated, %d bytes allocated at exit\n",
+               (uint32_t)stats.max_allocated_bytes, (uint32_t)stats.allocated_bytes);
+    }
+#endif
+}
+
+// kscan_mock exits the process once it has replayed every event, so report from an exit handler.
+static void report() {
+    uint64_t elapsed_ns = cpu_time_ns() - start_ns;
+
+    printk("kscan events: %d, keycode events: %d\n", KSCAN_EVENT_COUNT, keycode_event_count);
+    printk("cpu: %d ns/kscan event\n", (uint32_t)(elapsed_ns / MAX(KSCAN_EVENT_COUNT, 1)));
+    report_event_pools();
+    report_heap();
+}
+
+static int benchmark_listener(const zmk_event_t *eh) {
+    if (start_ns == 0 && as_zmk_position_state_changed(eh) != NULL) {
+        start_ns = cpu_time_ns();
+    } else if (as_zmk_keycode_state_changed(eh) != NULL) {
+        keycode_event_count++;
+    }
+
+    return ZMK_EV_EVENT_BUBBLE;
+}
+
+ZMK_LISTENER(benchmark, benchmark_listener);
+ZMK_SUBSCRIPTION(benchmark, zmk_position_state_changed);
+ZMK_SUBSCRIPTION(benchmark, zmk_keycode_state_changed);
+
+static int benchmark_init(const struct device *_arg) {
+    atexit(report);
+    return 0;
+}
+
+SYS_INIT(benchmark_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
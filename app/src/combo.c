@@ -9,6 +9,8 @@
 #include <zephyr/device.h>
 #include <zephyr/logging/log.h>
 #include <zephyr/sys/dlist.h>
+#include <zephyr/sys/math_extras.h>
+#include <zephyr/sys/util.h>
 #include <zephyr/kernel.h>
 
 #include <drivers/behavior.h>
@@ -26,7 +28,7 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 #if DT_HAS_COMPAT_STATUS_OKAY(DT_DRV_COMPAT)
 
 struct combo_cfg {
-    int32_t key_positions[CONFIG_ZMK_COMBO_MAX_KEYS_PER_COMBO];
+    const int32_t *key_positions;
     int32_t key_position_len;
     struct zmk_behavior_binding behavior;
     int32_t timeout_ms;
@@ -40,30 +42,57 @@ struct combo_cfg {
     int8_t layers[];
 };
 
+#define COMBO_ONE(n) +1
+#define COMBO_KEY_POSITIONS_LEN(n) +DT_PROP_LEN(n, key_positions)
+#define COMBO_KEY_POSITIONS_MEMBER(n) uint8_t combo_##n[DT_PROP_LEN(n, key_positions)];
+
+#define COMBO_COUNT (0 DT_INST_FOREACH_CHILD(0, COMBO_ONE))
+// the total number of key positions over all combos
+#define COMBO_KEY_POSITION_COUNT (0 DT_INST_FOREACH_CHILD(0, COMBO_KEY_POSITIONS_LEN))
+
+// the size of this union is the number of keys in the longest combo
+union combo_max_key_positions {
+    DT_INST_FOREACH_CHILD(0, COMBO_KEY_POSITIONS_MEMBER)
+};
+#define COMBO_MAX_KEY_POSITIONS sizeof(union combo_max_key_positions)
+
+// a set of combos, where bit n is set if combos[n] is in the set
+#define COMBO_SET_WORDS DIV_ROUND_UP(COMBO_COUNT, 32)
+typedef uint32_t combo_set_t[COMBO_SET_WORDS];
+
+#define COMBO_SET_FOREACH(set, id)                                                                 \
+    for (int _word = 0; _word < COMBO_SET_WORDS; _word++)                                          \
+        for (uint32_t _bits = (set)[_word], id;                                                    \
+             _bits != 0 && (id = _word * 32 + u32_count_trailing_zeros(_bits), true);              \
+             _bits &= _bits - 1)
+
 struct active_combo {
     struct combo_cfg *combo;
     // key_positions_pressed is filled with key_positions when the combo is pressed.
     // The keys are removed from this array when they are released.
     // Once this array is empty, the behavior is released.
-    const zmk_event_t *key_positions_pressed[CONFIG_ZMK_COMBO_MAX_KEYS_PER_COMBO];
+    const zmk_event_t *key_positions_pressed[COMBO_MAX_KEY_POSITIONS];
 };
 
-struct combo_candidate {
-    struct combo_cfg *combo;
-    // the time after which this behavior should be removed from candidates.
-    // by keeping track of when the candidate should be cleared there is no
-    // possibility of accidental releases.
-    int64_t timeout_at;
-};
+// all combos, sorted shortest-first, then by virtual-key-position.
+// a combo's index in this array is its id in combo sets.
+static struct combo_cfg *combos[COMBO_COUNT];
+// a compact index mapping a key position to the ids of all combos on that position:
+// combo_ids_by_position[combo_position_index[p]] up to combo_position_index[p + 1], in id order.
+static uint16_t combo_position_index[ZMK_KEYMAP_LEN + 1];
+static uint16_t combo_ids_by_position[COMBO_KEY_POSITION_COUNT];
 
 // set of keys pressed
-const zmk_event_t *pressed_keys[CONFIG_ZMK_COMBO_MAX_KEYS_PER_COMBO] = {NULL};
+const zmk_event_t *pressed_keys[COMBO_MAX_KEY_POSITIONS] = {NULL};
 // the set of candidate combos based on the currently pressed_keys
-struct combo_candidate candidates[CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY];
+static combo_set_t candidates;
+static int candidate_count = 0;
+// the time the first of the pressed_keys was pressed. candidates are removed once their
+// timeout has passed since then. by keeping track of when the candidate should be cleared
+// there is no possibility of accidental releases.
+static int64_t candidates_pressed_at;
 // the last candidate that was completely pressed
 struct combo_cfg *fully_pressed_combo = NULL;
-// a lookup dict that maps a key position to all combos on that position
-struct combo_cfg *combo_lookup[ZMK_KEYMAP_LEN][CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY] = {NULL};
 // combos that have been activated and still have (some) keys pressed
 // this array is always contiguous from 0.
 struct active_combo active_combos[CONFIG_ZMK_COMBO_MAX_PRESSED_COMBOS] = {NULL};
@@ -72,41 +101,48 @@ int active_combo_count = 0;
 struct k_work_delayable timeout_task;
 int64_t timeout_task_timeout_at;
 
-// Store the combo key pointer in the combos array, one pointer for each key position
-// The combos are sorted shortest-first, then by virtual-key-position.
-static int initialize_combo(struct combo_cfg *new_combo) {
+static bool combo_sorts_before(struct combo_cfg *a, struct combo_cfg *b) {
+    return a->key_position_len < b->key_position_len ||
+           (a->key_position_len == b->key_position_len &&
+            a->virtual_key_position < b->virtual_key_position);
+}
+
+// Insert the combo into the combos array, keeping it sorted.
+static int initialize_combo(struct combo_cfg *new_combo, int count) {
     for (int i = 0; i < new_combo->key_position_len; i++) {
         int32_t position = new_combo->key_positions[i];
-        if (position >= ZMK_KEYMAP_LEN) {
+        if (position < 0 || position >= ZMK_KEYMAP_LEN) {
             LOG_ERR("Unable to initialize combo, key position %d does not exist", position);
             return -EINVAL;
         }
+    }
 
-        struct combo_cfg *insert_combo = new_combo;
-        bool set = false;
-        for (int j = 0; j < CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY; j++) {
-            struct combo_cfg *combo_at_j = combo_lookup[position][j];
-            if (combo_at_j == NULL) {
-                combo_lookup[position][j] = insert_combo;
-                set = true;
-                break;
-            }
-            if (combo_at_j->key_position_len < insert_combo->key_position_len ||
-                (combo_at_j->key_position_len == insert_combo->key_position_len &&
-                 combo_at_j->virtual_key_position < insert_combo->virtual_key_position)) {
-                continue;
-            }
-            // put insert_combo in this spot, move all other combos up.
-            combo_lookup[position][j] = insert_combo;
-            insert_combo = combo_at_j;
+    int i = count;
+    for (; i > 0 && combo_sorts_before(new_combo, combos[i - 1]); i--) {
+        combos[i] = combos[i - 1];
+    }
+    combos[i] = new_combo;
+    return 0;
+}
+
+static void initialize_combo_index(int count) {
+    // count the combos on each position, then turn the counts into offsets
+    for (int id = 0; id < count; id++) {
+        for (int i = 0; i < combos[id]->key_position_len; i++) {
+            combo_position_index[combos[id]->key_positions[i] + 1]++;
         }
-        if (!set) {
-            LOG_ERR("Too many combos for key position %d, CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY %d.",
-                    position, CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY);
-            return -ENOMEM;
+    }
+    for (int position = 0; position < ZMK_KEYMAP_LEN; position++) {
+        combo_position_index[position + 1] += combo_position_index[position];
+    }
+
+    uint16_t fill[ZMK_KEYMAP_LEN];
+    memcpy(fill, combo_position_index, sizeof(fill));
+    for (int id = 0; id < count; id++) {
+        for (int i = 0; i < combos[id]->key_position_len; i++) {
+            combo_ids_by_position[fill[combos[id]->key_positions[i]]++] = id;
         }
     }
-    return 0;
 }
 
 static bool combo_active_on_layer(struct combo_cfg *combo, uint8_t layer) {
@@ -123,65 +159,45 @@ static bool combo_active_on_layer(struct combo_cfg *combo, uint8_t layer) {
 }
 
 static int setup_candidates_for_first_keypress(int32_t position, int64_t timestamp) {
-    int number_of_combo_candidates = 0;
     uint8_t highest_active_layer = zmk_keymap_highest_layer_active();
-    for (int i = 0; i < CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY; i++) {
-        struct combo_cfg *combo = combo_lookup[position][i];
-        if (combo == NULL) {
-            return number_of_combo_candidates;
+    for (int i = combo_position_index[position]; i < combo_position_index[position + 1]; i++) {
+        uint16_t id = combo_ids_by_position[i];
+        if (combo_active_on_layer(combos[id], highest_active_layer)) {
+            candidates[id / 32] |= BIT(id % 32);
+            candidate_count++;
         }
-        if (combo_active_on_layer(combo, highest_active_layer)) {
-            candidates[number_of_combo_candidates].combo = combo;
-            candidates[number_of_combo_candidates].timeout_at = timestamp + combo->timeout_ms;
-            number_of_combo_candidates++;
-        }
-        // LOG_DBG("combo timeout %d %d %d", position, i, candidates[i].timeout_at);
     }
-    return number_of_combo_candidates;
+    candidates_pressed_at = timestamp;
+    return candidate_count;
 }
 
 static int filter_candidates(int32_t position) {
-    // this code iterates over candidates and the lookup together to filter in O(n)
-    // assuming they are both sorted on key_position_len, virtal_key_position
-    int matches = 0, lookup_idx = 0, candidate_idx = 0;
-    while (lookup_idx < CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY &&
-           candidate_idx < CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY) {
-        struct combo_cfg *candidate = candidates[candidate_idx].combo;
-        struct combo_cfg *lookup = combo_lookup[position][lookup_idx];
-        if (candidate == NULL || lookup == NULL) {
-            break;
-        }
-        if (candidate->virtual_key_position == lookup->virtual_key_position) {
-            candidates[matches] = candidates[candidate_idx];
-            matches++;
-            candidate_idx++;
-            lookup_idx++;
-        } else if (candidate->key_position_len > lookup->key_position_len) {
-            lookup_idx++;
-        } else if (candidate->key_position_len < lookup->key_position_len) {
-            candidate_idx++;
-        } else if (candidate->virtual_key_position > lookup->virtual_key_position) {
-            lookup_idx++;
-        } else if (candidate->virtual_key_position < lookup->virtual_key_position) {
-            candidate_idx++;
-        }
+    combo_set_t on_position = {0};
+    for (int i = combo_position_index[position]; i < combo_position_index[position + 1]; i++) {
+        uint16_t id = combo_ids_by_position[i];
+        on_position[id / 32] |= BIT(id % 32);
     }
-    // clear unmatched candidates
-    for (int i = matches; i < CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY; i++) {
-        candidates[i].combo = NULL;
+
+    candidate_count = 0;
+    for (int word = 0; word < COMBO_SET_WORDS; word++) {
+        candidates[word] &= on_position[word];
+        candidate_count += POPCOUNT(candidates[word]);
     }
-    // LOG_DBG("combo matches after filter %d", matches);
-    return matches;
+    // LOG_DBG("combo matches after filter %d", candidate_count);
+    return candidate_count;
+}
+
+static struct combo_cfg *first_candidate() {
+    COMBO_SET_FOREACH(candidates, id) { return combos[id]; }
+    return NULL;
 }
 
 static int64_t first_candidate_timeout() {
-    int64_t first_timeout = LONG_MAX;
-    for (int i = 0; i < CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY; i++) {
-        if (candidates[i].combo == NULL) {
-            break;
-        }
-        if (candidates[i].timeout_at < first_timeout) {
-            first_timeout = candidates[i].timeout_at;
+    int64_t first_timeout = LLONG_MAX;
+    COMBO_SET_FOREACH(candidates, id) {
+        int64_t timeout_at = candidates_pressed_at + combos[id]->timeout_ms;
+        if (timeout_at < first_timeout) {
+            first_timeout = timeout_at;
         }
     }
     return first_timeout;
@@ -204,36 +220,24 @@ static inline bool candidate_is_completely_pressed(struct combo_cfg *candidate)
 static int cleanup();
 
 static int filter_timed_out_candidates(int64_t timestamp) {
-    int num_candidates = 0;
-    for (int i = 0; i < CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY; i++) {
-        struct combo_candidate *candidate = &candidates[i];
-        if (candidate->combo == NULL) {
-            break;
-        }
-        if (candidate->timeout_at > timestamp) {
-            // reorder candidates so they're contiguous
-            candidates[num_candidates].combo = candidate->combo;
-            candidates[num_candidates].timeout_at = candidate->timeout_at;
-            num_candidates++;
-        } else {
-            candidate->combo = NULL;
+    COMBO_SET_FOREACH(candidates, id) {
+        if (candidates_pressed_at + combos[id]->timeout_ms <= timestamp) {
+            candidates[id / 32] &= ~BIT(id % 32);
+            candidate_count--;
         }
     }
-    return num_candidates;
+    return candidate_count;
 }
 
 static int clear_candidates() {
-    for (int i = 0; i < CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY; i++) {
-        if (candidates[i].combo == NULL) {
-            return i;
-        }
-        candidates[i].combo = NULL;
-    }
-    return CONFIG_ZMK_COMBO_MAX_COMBOS_PER_KEY;
+    int cleared = candidate_count;
+    memset(candidates, 0, sizeof(candidates));
+    candidate_count = 0;
+    return cleared;
 }
 
 static int capture_pressed_key(const zmk_event_t *ev) {
-    for (int i = 0; i < CONFIG_ZMK_COMBO_MAX_KEYS_PER_COMBO; i++) {
+    for (int i = 0; i < COMBO_MAX_KEY_POSITIONS; i++) {
         if (pressed_keys[i] != NULL) {
             continue;
         }
@@ -246,7 +250,7 @@ static int capture_pressed_key(const zmk_event_t *ev) {
 const struct zmk_listener zmk_listener_combo;
 
 static int release_pressed_keys() {
-    for (int i = 0; i < CONFIG_ZMK_COMBO_MAX_KEYS_PER_COMBO; i++) {
+    for (int i = 0; i < COMBO_MAX_KEY_POSITIONS; i++) {
         const zmk_event_t *captured_event = pressed_keys[i];
         if (pressed_keys[i] == NULL) {
             return i;
@@ -263,10 +267,10 @@ static int release_pressed_keys() {
             ZMK_EVENT_RAISE(captured_event);
         }
     }
-    return CONFIG_ZMK_COMBO_MAX_KEYS_PER_COMBO;
+    return COMBO_MAX_KEY_POSITIONS;
 }
 
-static inline int press_combo_behavior(struct combo_cfg *combo, int32_t timestamp) {
+static inline int press_combo_behavior(struct combo_cfg *combo, int64_t timestamp) {
     struct zmk_behavior_binding_event event = {
         .position = combo->virtual_key_position,
         .timestamp = timestamp,
@@ -275,7 +279,7 @@ static inline int press_combo_behavior(struct combo_cfg *combo, int32_t timestam
     return behavior_keymap_binding_pressed(&combo->behavior, event);
 }
 
-static inline int release_combo_behavior(struct combo_cfg *combo, int32_t timestamp) {
+static inline int release_combo_behavior(struct combo_cfg *combo, int64_t timestamp) {
     struct zmk_behavior_binding_event event = {
         .position = combo->virtual_key_position,
         .timestamp = timestamp,
@@ -291,7 +295,7 @@ static void move_pressed_keys_to_active_combo(struct active_combo *active_combo)
         pressed_keys[i] = NULL;
     }
     // move any other pressed keys up
-    for (int i = 0; i + combo_length < CONFIG_ZMK_COMBO_MAX_KEYS_PER_COMBO; i++) {
+    for (int i = 0; i + combo_length < COMBO_MAX_KEY_POSITIONS; i++) {
         if (pressed_keys[i + combo_length] == NULL) {
             return;
         }
@@ -398,7 +402,7 @@ static void update_timeout_task() {
 
 static int position_state_down(const zmk_event_t *ev, struct zmk_position_state_changed *data) {
     int num_candidates;
-    if (candidates[0].combo == NULL) {
+    if (candidate_count == 0) {
         num_candidates = setup_candidates_for_first_keypress(data->position, data->timestamp);
         if (num_candidates == 0) {
             return 0;
@@ -409,7 +413,7 @@ static int position_state_down(const zmk_event_t *ev, struct zmk_position_state_
     }
     update_timeout_task();
 
-    struct combo_cfg *candidate_combo = candidates[0].combo;
+    struct combo_cfg *candidate_combo = first_candidate();
     LOG_DBG("combo: capturing position event %d", data->position);
     int ret = capture_pressed_key(ev);
     switch (num_candidates) {
@@ -472,9 +476,10 @@ ZMK_LISTENER(combo, position_state_changed_listener);
 ZMK_SUBSCRIPTION(combo, zmk_position_state_changed);
 
 #define COMBO_INST(n)                                                                              \
+    static const int32_t combo_key_positions_##n[] = DT_PROP(n, key_positions);                    \
     static struct combo_cfg combo_config_##n = {                                                   \
         .timeout_ms = DT_PROP(n, timeout_ms),                                                      \
-        .key_positions = DT_PROP(n, key_positions),                                                \
+        .key_positions = combo_key_positions_##n,                                                  \
         .key_position_len = DT_PROP_LEN(n, key_positions),                                         \
         .behavior = ZMK_KEYMAP_EXTRACT_BINDING(0, n),                                              \
         .virtual_key_position = ZMK_VIRTUAL_KEY_POSITION_COMBO(__COUNTER__),                       \
@@ -483,13 +488,18 @@ ZMK_SUBSCRIPTION(combo, zmk_position_state_changed);
         .layers_len = DT_PROP_LEN(n, layers),                                                      \
     };
 
-#define INITIALIZE_COMBO(n) initialize_combo(&combo_config_##n);
+#define INITIALIZE_COMBO(n)                                                                        \
+    if (initialize_combo(&combo_config_##n, count) == 0) {                                         \
+        count++;                                                                                   \
+    }
 
 DT_INST_FOREACH_CHILD(0, COMBO_INST)
 
 static int combo_init() {
+    int count = 0;
     k_work_init_delayable(&timeout_task, combo_timeout_handler);
     DT_INST_FOREACH_CHILD(0, INITIALIZE_COMBO);
+    initialize_combo_index(count);
     return 0;
 }
 
@@ -13,6 +13,7 @@
 #include <dt-bindings/zmk/hid_usage_pages.h>
 #include <zmk/usb_hid.h>
 #include <zmk/hog.h>
+#include <zmk/latency.h>
 #include <zmk/event_manager.h>
 #include <zmk/events/ble_active_profile_changed.h>
 #include <zmk/events/usb_conn_state_changed.h>
@@ -133,6 +134,7 @@ static int send_consumer_report() {
 int zmk_endpoints_send_report(uint16_t usage_page) {
 
     LOG_DBG("usage page 0x%02X", usage_page);
+    zmk_latency_record(ZMK_LATENCY_STAGE_REPORT_QUEUED);
     switch (usage_page) {
     case HID_USAGE_KEY:
         return send_keyboard_report();
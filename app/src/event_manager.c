@@ -4,6 +4,10 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <string.h>
+
+#include <zephyr/device.h>
+#include <zephyr/init.h>
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
 
@@ -17,14 +21,97 @@ extern struct zmk_event_type *__event_type_end[];
 extern struct zmk_event_subscription __event_subscriptions_start[];
 extern struct zmk_event_subscription __event_subscriptions_end[];
 
+#if IS_ENABLED(CONFIG_ZMK_EVENT_POOL)
+
+static bool event_pool_contains(const struct zmk_event_pool *pool, const void *block) {
+    const char *start = pool->slab->buffer;
+    const char *end = start + pool->slab->num_blocks * pool->slab->block_size;
+
+    return (const char *)block >= start && (const char *)block < end;
+}
+
+static void *event_pool_alloc(const struct zmk_event_type *event_type, size_t size) {
+    struct zmk_event_pool *pool = event_type->pool;
+    void *block;
+
+    if (k_mem_slab_alloc(pool->slab, &block, K_NO_WAIT) == 0) {
+        uint32_t used = k_mem_slab_num_used_get(pool->slab);
+        if (used > pool->high_water_mark) {
+            pool->high_water_mark = used;
+            LOG_DBG("%s pool high-water mark now %d of %d", event_type->name, used,
+                    CONFIG_ZMK_EVENT_POOL_SIZE);
+        }
+        return block;
+    }
+
+    pool->exhausted_count++;
+
+#if IS_ENABLED(CONFIG_ZMK_EVENT_POOL_HEAP_FALLBACK)
+    if (pool->exhausted_count == 1) {
+        LOG_WRN("%s pool exhausted, falling back to the heap. Consider increasing "
+                "CONFIG_ZMK_EVENT_POOL_SIZE",
+                event_type->name);
+    }
+    return k_malloc(size);
+#else
+    LOG_ERR("%s pool exhausted, dropping event (%d dropped so far)", event_type->name,
+            pool->exhausted_count);
+    return NULL;
+#endif /* IS_ENABLED(CONFIG_ZMK_EVENT_POOL_HEAP_FALLBACK) */
+}
+
+#endif /* IS_ENABLED(CONFIG_ZMK_EVENT_POOL) */
+
+void *zmk_event_manager_alloc(const struct zmk_event_type *event_type, size_t size) {
+#if IS_ENABLED(CONFIG_ZMK_EVENT_POOL)
+    return event_pool_alloc(event_type, size);
+#else
+    return k_malloc(size);
+#endif
+}
+
+void zmk_event_manager_free(zmk_event_t *event) {
+#if IS_ENABLED(CONFIG_ZMK_EVENT_POOL)
+    struct zmk_event_pool *pool = event->event->pool;
+    if (event_pool_contains(pool, event)) {
+        k_mem_slab_free(pool->slab, (void **)&event);
+        return;
+    }
+#endif
+
+    k_free(event);
+}
+
+// Indexes into the subscription section, grouped by event type and otherwise kept in section
+// order. Each event type's zmk_event_subscribers refers to its range of this table.
+static uint8_t subscription_table[UINT8_MAX];
+
+static inline const struct zmk_event_subscription *
+subscription_at(const struct zmk_event_subscribers *subscribers, uint8_t index) {
+    return __event_subscriptions_start + subscription_table[subscribers->start + index];
+}
+
+static int find_listener_index(const zmk_event_t *event, const struct zmk_listener *listener) {
+    const struct zmk_event_subscribers *subscribers = event->event->subscribers;
+    uint8_t ordinal = *listener->ordinal;
+    if (ordinal == UINT8_MAX) {
+        return -ENOENT;
+    }
+
+    uint8_t index = subscribers->listener_indexes[ordinal];
+    return index == UINT8_MAX ? -ENOENT : index;
+}
+
 int zmk_event_manager_handle_from(zmk_event_t *event, uint8_t start_index) {
+    if (event == NULL) {
+        LOG_ERR("Unable to raise event, allocation failed");
+        return -ENOMEM;
+    }
+
     int ret = 0;
-    uint8_t len = __event_subscriptions_end - __event_subscriptions_start;
-    for (int i = start_index; i < len; i++) {
-        struct zmk_event_subscription *ev_sub = __event_subscriptions_start + i;
-        if (ev_sub->event_type != event->event) {
-            continue;
-        }
+    const struct zmk_event_subscribers *subscribers = event->event->subscribers;
+    for (int i = start_index; i < subscribers->len; i++) {
+        const struct zmk_event_subscription *ev_sub = subscription_at(subscribers, i);
         event->last_listener_index = i;
         ret = ev_sub->listener->callback(event);
         switch (ret) {
@@ -45,20 +132,20 @@ int zmk_event_manager_handle_from(zmk_event_t *event, uint8_t start_index) {
     }
 
 release:
-    k_free(event);
+    zmk_event_manager_free(event);
     return ret;
 }
 
 int zmk_event_manager_raise(zmk_event_t *event) { return zmk_event_manager_handle_from(event, 0); }
 
 int zmk_event_manager_raise_after(zmk_event_t *event, const struct zmk_listener *listener) {
-    uint8_t len = __event_subscriptions_end - __event_subscriptions_start;
-    for (int i = 0; i < len; i++) {
-        struct zmk_event_subscription *ev_sub = __event_subscriptions_start + i;
+    if (event == NULL) {
+        return -ENOMEM;
+    }
 
-        if (ev_sub->event_type == event->event && ev_sub->listener == listener) {
-            return zmk_event_manager_handle_from(event, i + 1);
-        }
+    int index = find_listener_index(event, listener);
+    if (index >= 0) {
+        return zmk_event_manager_handle_from(event, index + 1);
     }
 
     LOG_WRN("Unable to find where to raise this after event");
@@ -67,13 +154,13 @@ int zmk_event_manager_raise_after(zmk_event_t *event, const struct zmk_listener
 }
 
 int zmk_event_manager_raise_at(zmk_event_t *event, const struct zmk_listener *listener) {
-    uint8_t len = __event_subscriptions_end - __event_subscriptions_start;
-    for (int i = 0; i < len; i++) {
-        struct zmk_event_subscription *ev_sub = __event_subscriptions_start + i;
+    if (event == NULL) {
+        return -ENOMEM;
+    }
 
-        if (ev_sub->event_type == event->event && ev_sub->listener == listener) {
-            return zmk_event_manager_handle_from(event, i);
-        }
+    int index = find_listener_index(event, listener);
+    if (index >= 0) {
+        return zmk_event_manager_handle_from(event, index);
     }
 
     LOG_WRN("Unable to find where to raise this event");
@@ -84,3 +171,59 @@ int zmk_event_manager_raise_at(zmk_event_t *event, const struct zmk_listener *li
 int zmk_event_manager_release(zmk_event_t *event) {
     return zmk_event_manager_handle_from(event, event->last_listener_index + 1);
 }
+
+static int zmk_event_manager_init(const struct device *_arg) {
+    size_t len = __event_subscriptions_end - __event_subscriptions_start;
+    if (len > ARRAY_SIZE(subscription_table)) {
+        LOG_ERR("Too many event subscriptions (%d), at most %d are supported", (int)len,
+                UINT8_MAX);
+        // Every event would be dropped without a listener to handle it, so don't carry on.
+        k_panic();
+        return -ENOMEM;
+    }
+
+    // Number the listeners in the order they first appear in the section. Listeners which aren't
+    // subscribed to anything keep UINT8_MAX, since there is nothing to raise an event after them.
+    uint8_t listener_count = 0;
+    for (uint8_t i = 0; i < len; i++) {
+        uint8_t *ordinal = __event_subscriptions_start[i].listener->ordinal;
+        if (*ordinal == UINT8_MAX) {
+            *ordinal = listener_count++;
+        }
+    }
+
+    // Each event type gets a row of the table, so finding a listener's index is a single lookup.
+    size_t table_size = (__event_type_end - __event_type_start) * listener_count;
+    uint8_t *listener_indexes = NULL;
+    if (table_size > 0) {
+        listener_indexes = k_malloc(table_size);
+        if (listener_indexes == NULL) {
+            LOG_ERR("Unable to allocate the listener index table (%d bytes)", (int)table_size);
+            k_panic();
+            return -ENOMEM;
+        }
+        memset(listener_indexes, UINT8_MAX, table_size);
+    }
+
+    uint8_t next = 0;
+    for (struct zmk_event_type **event_type = __event_type_start; event_type < __event_type_end;
+         event_type++) {
+        struct zmk_event_subscribers *subscribers = (*event_type)->subscribers;
+
+        subscribers->start = next;
+        subscribers->listener_indexes = listener_indexes;
+        for (uint8_t i = 0; i < len; i++) {
+            const struct zmk_event_subscription *ev_sub = &__event_subscriptions_start[i];
+            if (ev_sub->event_type == *event_type) {
+                listener_indexes[*ev_sub->listener->ordinal] = next - subscribers->start;
+                subscription_table[next++] = i;
+            }
+        }
+        subscribers->len = next - subscribers->start;
+        listener_indexes += listener_count;
+    }
+
+    return 0;
+}
+
+SYS_INIT(zmk_event_manager_init, PRE_KERNEL_1, CONFIG_KERNEL_INIT_PRIORITY_DEFAULT);
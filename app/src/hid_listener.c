@@ -5,6 +5,7 @@
  */
 
 #include <drivers/behavior.h>
+#include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
 
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
@@ -15,6 +16,134 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 #include <zmk/hid.h>
 #include <dt-bindings/zmk/hid_usage_pages.h>
 #include <zmk/endpoints.h>
+#include <zmk/keys.h>
+#include <zmk/latency.h>
+
+#if IS_ENABLED(CONFIG_ZMK_HID_REPORT_BATCHING)
+
+#define MAX_BATCHED_USAGES 16
+
+// Reports changed since the last flush, and the usages changed in them. A usage may only change
+// once per batch so that a tap (press and release in the same burst) is never merged away.
+static bool keyboard_report_dirty;
+static bool consumer_report_dirty;
+static uint32_t batched_usages[MAX_BATCHED_USAGES];
+static uint8_t batched_usages_len;
+
+// Whether a non-modifier key changed in the batch, and the modifiers it was reported with.
+static bool batched_keys_changed;
+static zmk_mod_flags_t batched_keys_modifiers;
+
+static uint32_t batch_trace_start;
+
+static void flush_batched_reports() {
+    bool keyboard_dirty = keyboard_report_dirty;
+    bool consumer_dirty = consumer_report_dirty;
+
+    keyboard_report_dirty = false;
+    consumer_report_dirty = false;
+    batched_usages_len = 0;
+    batched_keys_changed = false;
+
+    zmk_latency_trace_begin(batch_trace_start);
+    batch_trace_start = 0;
+
+    // Without batching, modifier changes for consumer page events are sent ahead of the consumer
+    // report, so keep that order.
+    if (keyboard_dirty) {
+        int err = zmk_endpoints_send_report(HID_USAGE_KEY);
+        if (err < 0) {
+            LOG_ERR("Failed to send batched key report (%d)", err);
+        }
+    }
+
+    if (consumer_dirty) {
+        int err = zmk_endpoints_send_report(HID_USAGE_CONSUMER);
+        if (err < 0) {
+            LOG_ERR("Failed to send batched consumer report (%d)", err);
+        }
+    }
+
+    zmk_latency_trace_end();
+}
+
+static void flush_batched_reports_work_handler(struct k_work *work) { flush_batched_reports(); }
+
+static K_WORK_DEFINE(flush_batched_reports_work, flush_batched_reports_work_handler);
+
+static bool usage_batched(uint32_t usage) {
+    for (int i = 0; i < batched_usages_len; i++) {
+        if (batched_usages[i] == usage) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Sends the pending batch first if merging the event into it would change what the host sees.
+static void batch_prepare(const struct zmk_keycode_state_changed *ev) {
+    uint32_t usage = ZMK_HID_USAGE(ev->usage_page, ev->keycode);
+    bool changes_mods = is_mod(ev->usage_page, ev->keycode) || ev->explicit_modifiers != 0 ||
+                        ev->implicit_modifiers != 0;
+
+    // A key changed earlier in the batch must not be reported with modifiers that changed after it,
+    // whether through this event or directly, e.g. by mod-morph masking modifiers.
+    bool reorders_mods =
+        batched_keys_changed &&
+        (changes_mods || zmk_hid_get_keyboard_report()->body.modifiers != batched_keys_modifiers);
+
+    // The batch sends the keyboard report ahead of the consumer report, so merging a change to
+    // one report after a change to the other could invert what the host sees. Modifier changes of
+    // a consumer page event go in the keyboard report.
+    bool changes_keyboard = ev->usage_page != HID_USAGE_CONSUMER || changes_mods;
+    bool changes_consumer = ev->usage_page == HID_USAGE_CONSUMER;
+    bool reorders_reports =
+        (changes_keyboard && consumer_report_dirty) || (changes_consumer && keyboard_report_dirty);
+
+    if (reorders_mods || reorders_reports || usage_batched(usage) ||
+        batched_usages_len == MAX_BATCHED_USAGES) {
+        flush_batched_reports();
+    }
+}
+
+static void batch_track(const struct zmk_keycode_state_changed *ev) {
+    batched_usages[batched_usages_len++] = ZMK_HID_USAGE(ev->usage_page, ev->keycode);
+
+    if (ev->usage_page == HID_USAGE_KEY && !is_mod(ev->usage_page, ev->keycode)) {
+        batched_keys_changed = true;
+        batched_keys_modifiers = zmk_hid_get_keyboard_report()->body.modifiers;
+    }
+
+    if (batch_trace_start == 0) {
+        batch_trace_start = zmk_latency_trace_start();
+    }
+
+    // Runs once the work item which raised this event, and any it is batched with, completes.
+    k_work_submit(&flush_batched_reports_work);
+}
+
+static int send_report(uint16_t usage_page) {
+    switch (usage_page) {
+    case HID_USAGE_KEY:
+        keyboard_report_dirty = true;
+        return 0;
+    case HID_USAGE_CONSUMER:
+        consumer_report_dirty = true;
+        return 0;
+    default:
+        LOG_ERR("Unsupported usage page %d", usage_page);
+        return -ENOTSUP;
+    }
+}
+
+#else
+
+static void batch_prepare(const struct zmk_keycode_state_changed *ev) {}
+static void batch_track(const struct zmk_keycode_state_changed *ev) {}
+
+static int send_report(uint16_t usage_page) { return zmk_endpoints_send_report(usage_page); }
+
+#endif /* IS_ENABLED(CONFIG_ZMK_HID_REPORT_BATCHING) */
 
 static int hid_listener_keycode_pressed(const struct zmk_keycode_state_changed *ev) {
     int err, explicit_mods_changed, implicit_mods_changed;
@@ -30,14 +159,14 @@ static int hid_listener_keycode_pressed(const struct zmk_keycode_state_changed *
     implicit_mods_changed = zmk_hid_implicit_modifiers_press(ev->implicit_modifiers);
     if (ev->usage_page != HID_USAGE_KEY &&
         (explicit_mods_changed > 0 || implicit_mods_changed > 0)) {
-        err = zmk_endpoints_send_report(HID_USAGE_KEY);
+        err = send_report(HID_USAGE_KEY);
         if (err < 0) {
             LOG_ERR("Failed to send key report for changed mofifiers for consumer page event (%d)",
                     err);
         }
     }
 
-    return zmk_endpoints_send_report(ev->usage_page);
+    return send_report(ev->usage_page);
 }
 
 static int hid_listener_keycode_released(const struct zmk_keycode_state_changed *ev) {
@@ -61,23 +190,26 @@ static int hid_listener_keycode_released(const struct zmk_keycode_state_changed
     ;
     if (ev->usage_page != HID_USAGE_KEY &&
         (explicit_mods_changed > 0 || implicit_mods_changed > 0)) {
-        err = zmk_endpoints_send_report(HID_USAGE_KEY);
+        err = send_report(HID_USAGE_KEY);
         if (err < 0) {
             LOG_ERR("Failed to send key report for changed mofifiers for consumer page event (%d)",
                     err);
         }
     }
-    return zmk_endpoints_send_report(ev->usage_page);
+    return send_report(ev->usage_page);
 }
 
 int hid_listener(const zmk_event_t *eh) {
     const struct zmk_keycode_state_changed *ev = as_zmk_keycode_state_changed(eh);
     if (ev) {
+        zmk_latency_record(ZMK_LATENCY_STAGE_KEYCODE_EVENT);
+        batch_prepare(ev);
         if (ev->state) {
             hid_listener_keycode_pressed(ev);
         } else {
             hid_listener_keycode_released(ev);
         }
+        batch_track(ev);
     }
     return 0;
 }
@@ -17,6 +17,7 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 #include <zmk/ble.h>
 #include <zmk/hog.h>
 #include <zmk/hid.h>
+#include <zmk/latency.h>
 
 enum {
     HIDS_REMOTE_WAKE = BIT(0),
@@ -161,13 +162,470 @@ K_THREAD_STACK_DEFINE(hog_q_stack, CONFIG_ZMK_BLE_THREAD_STACK_SIZE);
 
 struct k_work_q hog_work_q;
 
-K_MSGQ_DEFINE(zmk_hog_keyboard_msgq, sizeof(struct zmk_hid_keyboard_report_body),
-              CONFIG_ZMK_BLE_KEYBOARD_REPORT_QUEUE_SIZE, 4);
+static struct zmk_hog_report_stats report_stats[CONFIG_BT_MAX_CONN];
+
+// Reports merged, overflowed or dropped since the last report was sent, attributed to the
+// connection which the next report is sent to.
+static struct zmk_hog_report_stats pending_stats;
+
+static struct k_spinlock queue_lock;
+
+struct report_queue_api {
+    // Whether a queued report can be replaced by the next one without the host missing a press or
+    // release, or seeing changes in a different order.
+    bool (*can_merge)(const void *prev, const void *queued, const void *next);
+    bool (*has_usage)(const void *report, uint16_t usage);
+    // Presses the usage if it is released and the other way around. Returns false if the report
+    // has no room left to press it.
+    bool (*toggle_usage)(void *report, uint16_t usage);
+    // Marks the usages which changed between latest and next, after already changing between tail
+    // and latest.
+    void (*mark_bounces)(const void *tail, const void *latest, const void *next, uint8_t *bounced);
+};
+
+// Reports waiting to be notified to the host. Once the queue is full, reports which can't be
+// merged into the last queued one are folded into `latest` instead. Usages which changed more than
+// once since the last queued report are kept in `bounced`, and queued as extra reports between the
+// last queued report and `latest` once there is room, so the host never misses a press or release.
+struct report_queue {
+    const struct report_queue_api *api;
+    uint8_t *reports;
+    size_t report_size;
+    uint8_t capacity;
+    uint8_t head;
+    uint8_t len;
+    // The report most recently taken from the queue to be sent, which the host will see before the
+    // first queued report.
+    void *last_dequeued;
+    bool overflowing;
+    void *latest;
+    uint8_t *bounced;
+    uint16_t usage_count;
+};
+
+#define REPORT_QUEUE_DEFINE(name, report_type, size, usages, queue_api)                            \
+    static report_type name##_reports[size];                                                       \
+    static report_type name##_last_dequeued;                                                       \
+    static report_type name##_latest;                                                              \
+    static uint8_t name##_bounced[DIV_ROUND_UP(usages, 8)];                                        \
+    static struct report_queue name = {                                                            \
+        .api = &queue_api,                                                                         \
+        .reports = (uint8_t *)name##_reports,                                                      \
+        .report_size = sizeof(report_type),                                                        \
+        .capacity = size,                                                                          \
+        .last_dequeued = &name##_last_dequeued,                                                    \
+        .latest = &name##_latest,                                                                  \
+        .bounced = name##_bounced,                                                                 \
+        .usage_count = usages,                                                                     \
+    };
+
+static void *report_queue_at(struct report_queue *queue, uint8_t index) {
+    return queue->reports + ((queue->head + index) % queue->capacity) * queue->report_size;
+}
+
+static void *report_queue_tail(struct report_queue *queue) {
+    return queue->len > 0 ? report_queue_at(queue, queue->len - 1) : queue->last_dequeued;
+}
+
+static bool usage_bounced(const struct report_queue *queue, uint16_t usage) {
+    return queue->bounced[usage / 8] & BIT(usage % 8);
+}
+
+static void mark_bounced(uint8_t *bounced, uint16_t usage) { bounced[usage / 8] |= BIT(usage % 8); }
+
+static void clear_bounced(struct report_queue *queue, uint16_t usage) {
+    queue->bounced[usage / 8] &= ~BIT(usage % 8);
+}
+
+// Queues the next report of the overflow while there is room. Each report flips every bounced
+// usage, so a usage which changed twice is pressed and released again, and one which changed three
+// or more times takes one more report to end up the same as in `latest`.
+static void report_queue_refill(struct report_queue *queue) {
+    const struct report_queue_api *api = queue->api;
+
+    while (queue->overflowing && queue->len < queue->capacity) {
+        void *next = report_queue_at(queue, queue->len);
+        bool flipped = false;
+
+        memcpy(next, report_queue_tail(queue), queue->report_size);
+        for (uint16_t usage = 0; usage < queue->usage_count; usage++) {
+            if (!usage_bounced(queue, usage)) {
+                continue;
+            }
+
+            if (!api->toggle_usage(next, usage)) {
+                LOG_WRN("No room in the report to send bounced usage 0x%02X", usage);
+                clear_bounced(queue, usage);
+                continue;
+            }
+
+            flipped = true;
+            // The change back to its state in `latest` is in the next report.
+            if (api->has_usage(next, usage) != api->has_usage(queue->latest, usage)) {
+                clear_bounced(queue, usage);
+            }
+        }
+
+        if (!flipped) {
+            memcpy(next, queue->latest, queue->report_size);
+            queue->overflowing = false;
+        }
+
+        queue->len++;
+    }
+}
+
+static void report_queue_push(struct report_queue *queue, const void *report) {
+    const struct report_queue_api *api = queue->api;
+
+    if (queue->overflowing) {
+        api->mark_bounces(report_queue_tail(queue), queue->latest, report, queue->bounced);
+        memcpy(queue->latest, report, queue->report_size);
+        pending_stats.overflowed++;
+        return;
+    }
+
+    if (queue->len > 0) {
+        void *tail = report_queue_at(queue, queue->len - 1);
+        const void *prev =
+            queue->len > 1 ? report_queue_at(queue, queue->len - 2) : queue->last_dequeued;
+
+        if (api->can_merge(prev, tail, report)) {
+            memcpy(tail, report, queue->report_size);
+            pending_stats.merged++;
+            return;
+        }
+    }
+
+    if (queue->len == queue->capacity) {
+        LOG_WRN("Report queue full, holding back changes until there is room");
+        memcpy(queue->latest, report, queue->report_size);
+        memset(queue->bounced, 0, DIV_ROUND_UP(queue->usage_count, 8));
+        queue->overflowing = true;
+        pending_stats.overflowed++;
+        return;
+    }
+
+    memcpy(report_queue_at(queue, queue->len), report, queue->report_size);
+    queue->len++;
+}
+
+static bool report_queue_pop(struct report_queue *queue, void *report) {
+    if (queue->len == 0) {
+        return false;
+    }
+
+    memcpy(report, report_queue_at(queue, 0), queue->report_size);
+    memcpy(queue->last_dequeued, report, queue->report_size);
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->len--;
+
+    report_queue_refill(queue);
+
+    return true;
+}
+
+// Keyboard usages are numbered by their bit in the report, starting with the modifiers.
+#define KEYBOARD_MODIFIER_USAGES 8
+
+static bool keyboard_has_modifier(const struct zmk_hid_keyboard_report_body *report,
+                                  uint16_t usage) {
+    return report->modifiers & BIT(usage);
+}
+
+#if IS_ENABLED(CONFIG_ZMK_HID_REPORT_TYPE_NKRO)
+
+#define KEYBOARD_USAGES                                                                            \
+    (KEYBOARD_MODIFIER_USAGES + 8 * sizeof(((struct zmk_hid_keyboard_report_body *)0)->keys))
+
+static bool keys_changed(const struct zmk_hid_keyboard_report_body *prev,
+                         const struct zmk_hid_keyboard_report_body *next) {
+    return memcmp(prev->keys, next->keys, sizeof(prev->keys)) != 0;
+}
+
+static bool keys_changed_twice(const struct zmk_hid_keyboard_report_body *prev,
+                               const struct zmk_hid_keyboard_report_body *mid,
+                               const struct zmk_hid_keyboard_report_body *next) {
+    for (int i = 0; i < sizeof(mid->keys); i++) {
+        if ((prev->keys[i] ^ mid->keys[i]) & (mid->keys[i] ^ next->keys[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool keyboard_has_key(const struct zmk_hid_keyboard_report_body *report, uint8_t key) {
+    return report->keys[key / 8] & BIT(key % 8);
+}
+
+static bool keyboard_toggle_key(struct zmk_hid_keyboard_report_body *report, uint8_t key) {
+    report->keys[key / 8] ^= BIT(key % 8);
+    return true;
+}
+
+static void keyboard_mark_key_bounces(const struct zmk_hid_keyboard_report_body *tail,
+                                      const struct zmk_hid_keyboard_report_body *latest,
+                                      const struct zmk_hid_keyboard_report_body *next,
+                                      uint8_t *bounced) {
+    for (int i = 0; i < sizeof(next->keys); i++) {
+        bounced[KEYBOARD_MODIFIER_USAGES / 8 + i] |=
+            (tail->keys[i] ^ latest->keys[i]) & (latest->keys[i] ^ next->keys[i]);
+    }
+}
+
+#elif IS_ENABLED(CONFIG_ZMK_HID_REPORT_TYPE_HKRO)
+
+#define KEYBOARD_USAGES (KEYBOARD_MODIFIER_USAGES + UINT8_MAX + 1)
+
+static bool report_has_key(const struct zmk_hid_keyboard_report_body *report, uint8_t key) {
+    for (int i = 0; i < sizeof(report->keys); i++) {
+        if (report->keys[i] == key) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool keys_changed(const struct zmk_hid_keyboard_report_body *prev,
+                         const struct zmk_hid_keyboard_report_body *next) {
+    for (int i = 0; i < sizeof(prev->keys); i++) {
+        if ((prev->keys[i] != 0 && !report_has_key(next, prev->keys[i])) ||
+            (next->keys[i] != 0 && !report_has_key(prev, next->keys[i]))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool key_changed_twice(const struct zmk_hid_keyboard_report_body *prev,
+                              const struct zmk_hid_keyboard_report_body *mid,
+                              const struct zmk_hid_keyboard_report_body *next, uint8_t key) {
+    bool in_mid = report_has_key(mid, key);
+    return key != 0 && report_has_key(prev, key) != in_mid && report_has_key(next, key) != in_mid;
+}
+
+static bool keys_changed_twice(const struct zmk_hid_keyboard_report_body *prev,
+                               const struct zmk_hid_keyboard_report_body *mid,
+                               const struct zmk_hid_keyboard_report_body *next) {
+    // A key which changes twice is either only in the middle report or missing only from it.
+    for (int i = 0; i < sizeof(mid->keys); i++) {
+        if (key_changed_twice(prev, mid, next, prev->keys[i]) ||
+            key_changed_twice(prev, mid, next, mid->keys[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool keyboard_has_key(const struct zmk_hid_keyboard_report_body *report, uint8_t key) {
+    return key != 0 && report_has_key(report, key);
+}
+
+static bool keyboard_toggle_key(struct zmk_hid_keyboard_report_body *report, uint8_t key) {
+    bool pressed = report_has_key(report, key);
+    for (int i = 0; i < sizeof(report->keys); i++) {
+        if (report->keys[i] == (pressed ? key : 0)) {
+            report->keys[i] = pressed ? 0 : key;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void keyboard_mark_key_bounces(const struct zmk_hid_keyboard_report_body *tail,
+                                      const struct zmk_hid_keyboard_report_body *latest,
+                                      const struct zmk_hid_keyboard_report_body *next,
+                                      uint8_t *bounced) {
+    // A key which changed between latest and next is in one of them.
+    for (int i = 0; i < sizeof(next->keys); i++) {
+        if (key_changed_twice(tail, latest, next, latest->keys[i])) {
+            mark_bounced(bounced, KEYBOARD_MODIFIER_USAGES + latest->keys[i]);
+        }
+        if (key_changed_twice(tail, latest, next, next->keys[i])) {
+            mark_bounced(bounced, KEYBOARD_MODIFIER_USAGES + next->keys[i]);
+        }
+    }
+}
+
+#endif
+
+static bool keyboard_can_merge(const void *prev_report, const void *queued_report,
+                               const void *next_report) {
+    const struct zmk_hid_keyboard_report_body *prev = prev_report;
+    const struct zmk_hid_keyboard_report_body *queued = queued_report;
+    const struct zmk_hid_keyboard_report_body *next = next_report;
+
+    if ((prev->modifiers ^ queued->modifiers) & (queued->modifiers ^ next->modifiers)) {
+        return false;
+    }
+
+    // A modifier change must not be sent ahead of a key change which happened before it.
+    if (queued->modifiers != next->modifiers && keys_changed(prev, queued)) {
+        return false;
+    }
+
+    return !keys_changed_twice(prev, queued, next);
+}
+
+static bool keyboard_has_usage(const void *report, uint16_t usage) {
+    if (usage < KEYBOARD_MODIFIER_USAGES) {
+        return keyboard_has_modifier(report, usage);
+    }
+    return keyboard_has_key(report, usage - KEYBOARD_MODIFIER_USAGES);
+}
+
+static bool keyboard_toggle_usage(void *report, uint16_t usage) {
+    if (usage < KEYBOARD_MODIFIER_USAGES) {
+        ((struct zmk_hid_keyboard_report_body *)report)->modifiers ^= BIT(usage);
+        return true;
+    }
+    return keyboard_toggle_key(report, usage - KEYBOARD_MODIFIER_USAGES);
+}
+
+static void keyboard_mark_bounces(const void *tail_report, const void *latest_report,
+                                  const void *next_report, uint8_t *bounced) {
+    const struct zmk_hid_keyboard_report_body *tail = tail_report;
+    const struct zmk_hid_keyboard_report_body *latest = latest_report;
+    const struct zmk_hid_keyboard_report_body *next = next_report;
+
+    bounced[0] |= (tail->modifiers ^ latest->modifiers) & (latest->modifiers ^ next->modifiers);
+    keyboard_mark_key_bounces(tail, latest, next, bounced);
+}
+
+static const struct report_queue_api keyboard_queue_api = {
+    .can_merge = keyboard_can_merge,
+    .has_usage = keyboard_has_usage,
+    .toggle_usage = keyboard_toggle_usage,
+    .mark_bounces = keyboard_mark_bounces,
+};
+
+REPORT_QUEUE_DEFINE(keyboard_queue, struct zmk_hid_keyboard_report_body,
+                    CONFIG_ZMK_BLE_KEYBOARD_REPORT_QUEUE_SIZE, KEYBOARD_USAGES, keyboard_queue_api);
+
+#if IS_ENABLED(CONFIG_ZMK_HID_CONSUMER_REPORT_USAGES_BASIC)
+#define CONSUMER_USAGES (UINT8_MAX + 1)
+#elif IS_ENABLED(CONFIG_ZMK_HID_CONSUMER_REPORT_USAGES_FULL)
+// The logical maximum of the consumer report in the report descriptor.
+#define CONSUMER_USAGES 0x1000
+#endif
+
+static bool consumer_has_usage(const void *report, uint16_t usage) {
+    const struct zmk_hid_consumer_report_body *body = report;
+
+    if (usage == 0) {
+        return false;
+    }
+
+    for (int i = 0; i < CONFIG_ZMK_HID_CONSUMER_REPORT_SIZE; i++) {
+        if (body->keys[i] == usage) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool consumer_changed_twice(const struct zmk_hid_consumer_report_body *prev,
+                                   const struct zmk_hid_consumer_report_body *mid,
+                                   const struct zmk_hid_consumer_report_body *next,
+                                   uint16_t usage) {
+    bool in_mid = consumer_has_usage(mid, usage);
+    return consumer_has_usage(prev, usage) != in_mid && consumer_has_usage(next, usage) != in_mid;
+}
+
+static bool consumer_can_merge(const void *prev_report, const void *queued_report,
+                               const void *next_report) {
+    const struct zmk_hid_consumer_report_body *prev = prev_report;
+    const struct zmk_hid_consumer_report_body *queued = queued_report;
+    const struct zmk_hid_consumer_report_body *next = next_report;
+
+    // A usage which changes twice is either only in the middle report or missing only from it.
+    for (int i = 0; i < CONFIG_ZMK_HID_CONSUMER_REPORT_SIZE; i++) {
+        if (consumer_changed_twice(prev, queued, next, prev->keys[i]) ||
+            consumer_changed_twice(prev, queued, next, queued->keys[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool consumer_toggle_usage(void *report, uint16_t usage) {
+    struct zmk_hid_consumer_report_body *body = report;
+    bool pressed = consumer_has_usage(body, usage);
+
+    for (int i = 0; i < CONFIG_ZMK_HID_CONSUMER_REPORT_SIZE; i++) {
+        if (body->keys[i] == (pressed ? usage : 0)) {
+            body->keys[i] = pressed ? 0 : usage;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void consumer_mark_bounces(const void *tail_report, const void *latest_report,
+                                  const void *next_report, uint8_t *bounced) {
+    const struct zmk_hid_consumer_report_body *tail = tail_report;
+    const struct zmk_hid_consumer_report_body *latest = latest_report;
+    const struct zmk_hid_consumer_report_body *next = next_report;
+
+    // A usage which changed between latest and next is in one of them.
+    for (int i = 0; i < CONFIG_ZMK_HID_CONSUMER_REPORT_SIZE; i++) {
+        if (latest->keys[i] < CONSUMER_USAGES &&
+            consumer_changed_twice(tail, latest, next, latest->keys[i])) {
+            mark_bounced(bounced, latest->keys[i]);
+        }
+        if (next->keys[i] < CONSUMER_USAGES &&
+            consumer_changed_twice(tail, latest, next, next->keys[i])) {
+            mark_bounced(bounced, next->keys[i]);
+        }
+    }
+}
+
+static const struct report_queue_api consumer_queue_api = {
+    .can_merge = consumer_can_merge,
+    .has_usage = consumer_has_usage,
+    .toggle_usage = consumer_toggle_usage,
+    .mark_bounces = consumer_mark_bounces,
+};
+
+REPORT_QUEUE_DEFINE(consumer_queue, struct zmk_hid_consumer_report_body,
+                    CONFIG_ZMK_BLE_CONSUMER_REPORT_QUEUE_SIZE, CONSUMER_USAGES, consumer_queue_api);
+
+// Latency trace of the most recently queued keyboard report. If several reports are queued at
+// once, the sent time is attributed to the latest one.
+static uint32_t keyboard_report_trace_start;
+
+static struct zmk_hog_report_stats *stats_for_send(struct bt_conn *conn) {
+    struct zmk_hog_report_stats *stats = &report_stats[bt_conn_index(conn)];
+
+    k_spinlock_key_t key = k_spin_lock(&queue_lock);
+    stats->merged += pending_stats.merged;
+    stats->overflowed += pending_stats.overflowed;
+    stats->dropped += pending_stats.dropped;
+    pending_stats.merged = 0;
+    pending_stats.overflowed = 0;
+    pending_stats.dropped = 0;
+    k_spin_unlock(&queue_lock, key);
+
+    return stats;
+}
 
 void send_keyboard_report_callback(struct k_work *work) {
-    struct zmk_hid_keyboard_report_body report;
+    while (true) {
+        struct zmk_hid_keyboard_report_body report;
+        uint32_t trace_start = 0;
+
+        k_spinlock_key_t key = k_spin_lock(&queue_lock);
+        bool dequeued = report_queue_pop(&keyboard_queue, &report);
+        if (dequeued && keyboard_queue.len == 0) {
+            trace_start = keyboard_report_trace_start;
+            keyboard_report_trace_start = 0;
+        }
+        k_spin_unlock(&queue_lock, key);
+
+        if (!dequeued) {
+            break;
+        }
 
-    while (k_msgq_get(&zmk_hog_keyboard_msgq, &report, K_NO_WAIT) == 0) {
         struct bt_conn *conn = destination_connection();
         if (conn == NULL) {
             return;
@@ -179,9 +637,17 @@ void send_keyboard_report_callback(struct k_work *work) {
             .len = sizeof(report),
         };
 
+        struct zmk_hog_report_stats *stats = stats_for_send(conn);
+
         int err = bt_gatt_notify_cb(conn, &notify_params);
         if (err) {
             LOG_ERR("Error notifying %d", err);
+            stats->dropped++;
+        } else {
+            stats->sent++;
+            if (trace_start != 0) {
+                zmk_latency_record_from(ZMK_LATENCY_STAGE_REPORT_SENT, trace_start);
+            }
         }
 
         bt_conn_unref(conn);
@@ -191,33 +657,30 @@ void send_keyboard_report_callback(struct k_work *work) {
 K_WORK_DEFINE(hog_keyboard_work, send_keyboard_report_callback);
 
 int zmk_hog_send_keyboard_report(struct zmk_hid_keyboard_report_body *report) {
-    int err = k_msgq_put(&zmk_hog_keyboard_msgq, report, K_MSEC(100));
-    if (err) {
-        switch (err) {
-        case -EAGAIN: {
-            LOG_WRN("Keyboard message queue full, popping first message and queueing again");
-            struct zmk_hid_keyboard_report_body discarded_report;
-            k_msgq_get(&zmk_hog_keyboard_msgq, &discarded_report, K_NO_WAIT);
-            return zmk_hog_send_keyboard_report(report);
-        }
-        default:
-            LOG_WRN("Failed to queue keyboard report to send (%d)", err);
-            return err;
-        }
-    }
+    uint32_t trace_start = zmk_latency_trace_start();
+
+    k_spinlock_key_t key = k_spin_lock(&queue_lock);
+    report_queue_push(&keyboard_queue, report);
+    keyboard_report_trace_start = trace_start;
+    k_spin_unlock(&queue_lock, key);
 
     k_work_submit_to_queue(&hog_work_q, &hog_keyboard_work);
 
     return 0;
 };
 
-K_MSGQ_DEFINE(zmk_hog_consumer_msgq, sizeof(struct zmk_hid_consumer_report_body),
-              CONFIG_ZMK_BLE_CONSUMER_REPORT_QUEUE_SIZE, 4);
-
 void send_consumer_report_callback(struct k_work *work) {
-    struct zmk_hid_consumer_report_body report;
+    while (true) {
+        struct zmk_hid_consumer_report_body report;
+
+        k_spinlock_key_t key = k_spin_lock(&queue_lock);
+        bool dequeued = report_queue_pop(&consumer_queue, &report);
+        k_spin_unlock(&queue_lock, key);
+
+        if (!dequeued) {
+            break;
+        }
 
-    while (k_msgq_get(&zmk_hog_consumer_msgq, &report, K_NO_WAIT) == 0) {
         struct bt_conn *conn = destination_connection();
         if (conn == NULL) {
             return;
@@ -229,9 +692,14 @@ void send_consumer_report_callback(struct k_work *work) {
             .len = sizeof(report),
         };
 
+        struct zmk_hog_report_stats *stats = stats_for_send(conn);
+
         int err = bt_gatt_notify_cb(conn, &notify_params);
         if (err) {
             LOG_DBG("Error notifying %d", err);
+            stats->dropped++;
+        } else {
+            stats->sent++;
         }
 
         bt_conn_unref(conn);
@@ -241,31 +709,51 @@ void send_consumer_report_callback(struct k_work *work) {
 K_WORK_DEFINE(hog_consumer_work, send_consumer_report_callback);
 
 int zmk_hog_send_consumer_report(struct zmk_hid_consumer_report_body *report) {
-    int err = k_msgq_put(&zmk_hog_consumer_msgq, report, K_MSEC(100));
-    if (err) {
-        switch (err) {
-        case -EAGAIN: {
-            LOG_WRN("Consumer message queue full, popping first message and queueing again");
-            struct zmk_hid_consumer_report_body discarded_report;
-            k_msgq_get(&zmk_hog_consumer_msgq, &discarded_report, K_NO_WAIT);
-            return zmk_hog_send_consumer_report(report);
-        }
-        default:
-            LOG_WRN("Failed to queue consumer report to send (%d)", err);
-            return err;
-        }
-    }
+    k_spinlock_key_t key = k_spin_lock(&queue_lock);
+    report_queue_push(&consumer_queue, report);
+    k_spin_unlock(&queue_lock, key);
 
     k_work_submit_to_queue(&hog_work_q, &hog_consumer_work);
 
     return 0;
 };
 
+int zmk_hog_get_report_stats(struct bt_conn *conn, struct zmk_hog_report_stats *stats) {
+    if (conn == NULL) {
+        return -EINVAL;
+    }
+
+    *stats = report_stats[bt_conn_index(conn)];
+    return 0;
+}
+
+static void hog_connected(struct bt_conn *conn, uint8_t err) {
+    if (err) {
+        return;
+    }
+
+    memset(&report_stats[bt_conn_index(conn)], 0, sizeof(struct zmk_hog_report_stats));
+}
+
+static void hog_disconnected(struct bt_conn *conn, uint8_t reason) {
+    const struct zmk_hog_report_stats *stats = &report_stats[bt_conn_index(conn)];
+
+    LOG_DBG("HID reports sent %d, merged %d, overflowed %d, dropped %d", stats->sent,
+            stats->merged, stats->overflowed, stats->dropped);
+}
+
+static struct bt_conn_cb conn_callbacks = {
+    .connected = hog_connected,
+    .disconnected = hog_disconnected,
+};
+
 int zmk_hog_init(const struct device *_arg) {
     static const struct k_work_queue_config queue_config = {.name = "HID Over GATT Send Work"};
     k_work_queue_start(&hog_work_q, hog_q_stack, K_THREAD_STACK_SIZEOF(hog_q_stack),
                        CONFIG_ZMK_BLE_THREAD_PRIORITY, &queue_config);
 
+    bt_conn_cb_register(&conn_callbacks);
+
     return 0;
 }
 
@@ -5,6 +5,7 @@
  */
 
 #include <drivers/behavior.h>
+#include <zephyr/sys/math_extras.h>
 #include <zephyr/sys/util.h>
 #include <zephyr/bluetooth/bluetooth.h>
 #include <zephyr/logging/log.h>
@@ -12,6 +13,7 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
 #include <zmk/behavior.h>
 #include <zmk/keymap.h>
+#include <zmk/latency.h>
 #include <zmk/matrix.h>
 #include <zmk/sensors.h>
 #include <zmk/virtual_key_position.h>
@@ -28,6 +30,7 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
 static zmk_keymap_layers_state_t _zmk_keymap_layer_state = 0;
 static uint8_t _zmk_keymap_layer_default = 0;
+static uint8_t _zmk_keymap_highest_layer_active = 0;
 
 #define DT_DRV_COMPAT zmk_keymap
 
@@ -67,6 +70,10 @@ static uint32_t zmk_keymap_active_behavior_layer[ZMK_KEYMAP_LEN];
 static struct zmk_behavior_binding zmk_keymap[ZMK_KEYMAP_LAYERS_LEN][ZMK_KEYMAP_LEN] = {
     DT_INST_FOREACH_CHILD(0, TRANSFORMED_LAYER)};
 
+// For each position, the layers whose binding isn't transparent. Positions are only processed on
+// these layers, so transparent bindings fall through without invoking their behavior.
+static zmk_keymap_layers_state_t zmk_keymap_opaque_layers[ZMK_KEYMAP_LEN];
+
 static const char *zmk_keymap_layer_names[ZMK_KEYMAP_LAYERS_LEN] = {
     DT_INST_FOREACH_CHILD(0, LAYER_LABEL)};
 
@@ -78,6 +85,10 @@ static struct zmk_behavior_binding zmk_sensor_keymap[ZMK_KEYMAP_LAYERS_LEN]
 
 #endif /* ZMK_KEYMAP_HAS_SENSORS */
 
+static inline uint8_t highest_layer_with_state(zmk_keymap_layers_state_t state) {
+    return 31 - u32_count_leading_zeros(state);
+}
+
 static inline int set_layer_state(uint8_t layer, bool state) {
     if (layer >= ZMK_KEYMAP_LAYERS_LEN) {
         return -EINVAL;
@@ -92,6 +103,8 @@ static inline int set_layer_state(uint8_t layer, bool state) {
     WRITE_BIT(_zmk_keymap_layer_state, layer, state);
     // Don't send state changes unless there was an actual change
     if (old_state != _zmk_keymap_layer_state) {
+        _zmk_keymap_highest_layer_active = highest_layer_with_state(
+            _zmk_keymap_layer_state | BIT(_zmk_keymap_layer_default));
         LOG_DBG("layer_changed: layer %d state %d", layer, state);
         ZMK_EVENT_RAISE(create_layer_state_changed(layer, state));
     }
@@ -113,14 +126,7 @@ bool zmk_keymap_layer_active(uint8_t layer) {
     return zmk_keymap_layer_active_with_state(layer, _zmk_keymap_layer_state);
 };
 
-uint8_t zmk_keymap_highest_layer_active() {
-    for (uint8_t layer = ZMK_KEYMAP_LAYERS_LEN - 1; layer > 0; layer--) {
-        if (zmk_keymap_layer_active(layer)) {
-            return layer;
-        }
-    }
-    return zmk_keymap_layer_default();
-}
+uint8_t zmk_keymap_highest_layer_active() { return _zmk_keymap_highest_layer_active; }
 
 int zmk_keymap_layer_activate(uint8_t layer) { return set_layer_state(layer, true); };
 
@@ -158,6 +164,8 @@ const char *zmk_keymap_layer_label(uint8_t layer) {
 
 int invoke_locally(struct zmk_behavior_binding *binding, struct zmk_behavior_binding_event event,
                    bool pressed) {
+    zmk_latency_record(ZMK_LATENCY_STAGE_BEHAVIOR);
+
     if (pressed) {
         return behavior_keymap_binding_pressed(binding, event);
     } else {
@@ -179,7 +187,7 @@ int zmk_keymap_apply_position_state(uint8_t source, int layer, uint32_t position
 
     LOG_DBG("layer: %d position: %d, binding name: %s", layer, position, binding.behavior_dev);
 
-    behavior = device_get_binding(binding.behavior_dev);
+    behavior = zmk_behavior_get_binding_device(&binding);
 
     if (!behavior) {
         LOG_WRN("No behavior assigned to %d on layer %d", position, layer);
@@ -214,9 +222,7 @@ int zmk_keymap_apply_position_state(uint8_t source, int layer, uint32_t position
 #endif
     case BEHAVIOR_LOCALITY_GLOBAL:
 #if ZMK_BLE_IS_CENTRAL
-        for (int i = 0; i < ZMK_SPLIT_BLE_PERIPHERAL_COUNT; i++) {
-            zmk_split_bt_invoke_behavior(i, &binding, event, pressed);
-        }
+        zmk_split_bt_invoke_behavior_all(&binding, event, pressed);
 #endif
         return invoke_locally(&binding, event, pressed);
     }
@@ -229,18 +235,25 @@ int zmk_keymap_position_state_changed(uint8_t source, uint32_t position, bool pr
     if (pressed) {
         zmk_keymap_active_behavior_layer[position] = _zmk_keymap_layer_state;
     }
-    for (int layer = ZMK_KEYMAP_LAYERS_LEN - 1; layer >= _zmk_keymap_layer_default; layer--) {
-        if (zmk_keymap_layer_active_with_state(layer, zmk_keymap_active_behavior_layer[position])) {
-            int ret = zmk_keymap_apply_position_state(source, layer, position, pressed, timestamp);
-            if (ret > 0) {
-                LOG_DBG("behavior processing to continue to next layer");
-                continue;
-            } else if (ret < 0) {
-                LOG_DBG("Behavior returned error: %d", ret);
-                return ret;
-            } else {
-                return ret;
-            }
+
+    // Active layers from the default layer up, highest first.
+    zmk_keymap_layers_state_t layers =
+        (zmk_keymap_active_behavior_layer[position] | BIT(_zmk_keymap_layer_default)) &
+        ~BIT_MASK(_zmk_keymap_layer_default) & zmk_keymap_opaque_layers[position];
+
+    while (layers) {
+        uint8_t layer = highest_layer_with_state(layers);
+        WRITE_BIT(layers, layer, false);
+
+        int ret = zmk_keymap_apply_position_state(source, layer, position, pressed, timestamp);
+        if (ret > 0) {
+            LOG_DBG("behavior processing to continue to next layer");
+            continue;
+        } else if (ret < 0) {
+            LOG_DBG("Behavior returned error: %d", ret);
+            return ret;
+        } else {
+            return ret;
         }
     }
 
@@ -259,7 +272,7 @@ int zmk_keymap_sensor_event(uint8_t sensor_index,
         LOG_DBG("layer: %d sensor_index: %d, binding name: %s", layer, sensor_index,
                 binding->behavior_dev);
 
-        const struct device *behavior = device_get_binding(binding->behavior_dev);
+        const struct device *behavior = zmk_behavior_get_binding_device(binding);
         if (!behavior) {
             LOG_DBG("No behavior assigned to %d on layer %d", sensor_index, layer);
             continue;
@@ -304,9 +317,46 @@ int zmk_keymap_sensor_event(uint8_t sensor_index,
 
 #endif /* ZMK_KEYMAP_HAS_SENSORS */
 
+static void resolve_binding(struct zmk_behavior_binding *binding) {
+    binding->behavior = device_get_binding(binding->behavior_dev);
+}
+
+// Resolve every binding's behavior device once, so that key events don't need to look up
+// behaviors by name. This must run after the behavior devices have been initialized, since
+// device_get_binding() only returns devices which are ready.
+static int zmk_keymap_init(const struct device *_arg) {
+#if DT_HAS_COMPAT_STATUS_OKAY(zmk_behavior_transparent)
+    const struct device *transparent =
+        device_get_binding(DT_PROP(DT_INST(0, zmk_behavior_transparent), label));
+#else
+    const struct device *transparent = NULL;
+#endif
+
+    for (int layer = 0; layer < ZMK_KEYMAP_LAYERS_LEN; layer++) {
+        for (int position = 0; position < ZMK_KEYMAP_LEN; position++) {
+            struct zmk_behavior_binding *binding = &zmk_keymap[layer][position];
+            resolve_binding(binding);
+
+            bool is_transparent = transparent != NULL && binding->behavior == transparent;
+            WRITE_BIT(zmk_keymap_opaque_layers[position], layer, !is_transparent);
+        }
+
+#if ZMK_KEYMAP_HAS_SENSORS
+        for (int sensor_index = 0; sensor_index < ZMK_KEYMAP_SENSORS_LEN; sensor_index++) {
+            resolve_binding(&zmk_sensor_keymap[layer][sensor_index]);
+        }
+#endif /* ZMK_KEYMAP_HAS_SENSORS */
+    }
+
+    return 0;
+}
+
+SYS_INIT(zmk_keymap_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+
 int keymap_listener(const zmk_event_t *eh) {
     const struct zmk_position_state_changed *pos_ev;
     if ((pos_ev = as_zmk_position_state_changed(eh)) != NULL) {
+        zmk_latency_record(ZMK_LATENCY_STAGE_POSITION_EVENT);
         return zmk_keymap_position_state_changed(pos_ev->source, pos_ev->position, pos_ev->state,
                                                  pos_ev->timestamp);
     }
@@ -9,69 +9,208 @@
 #include <zephyr/bluetooth/addr.h>
 #include <zephyr/drivers/kscan.h>
 #include <zephyr/logging/log.h>
+#include <zephyr/sys/atomic.h>
 
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
+#include <zmk/kscan.h>
+#include <zmk/matrix.h>
 #include <zmk/matrix_transform.h>
+#include <zmk/latency.h>
 #include <zmk/event_manager.h>
 #include <zmk/events/position_state_changed.h>
 
-#define ZMK_KSCAN_EVENT_STATE_PRESSED 0
-#define ZMK_KSCAN_EVENT_STATE_RELEASED 1
+#define QUEUE_SIZE CONFIG_ZMK_KSCAN_EVENT_QUEUE_SIZE
+
+// Queue indices run from 0 to 2 * QUEUE_SIZE - 1, so a full queue can be told apart from an empty
+// one without wasting a slot or requiring QUEUE_SIZE to be a power of two.
+#define QUEUE_INDEX_WRAP (2 * QUEUE_SIZE)
+
+#define ZMK_KSCAN_EVENT_PRESSED BIT(31)
+#define ZMK_KSCAN_EVENT_POSITION_MASK BIT_MASK(16)
+
+BUILD_ASSERT(ZMK_KEYMAP_LEN <= ZMK_KSCAN_EVENT_POSITION_MASK,
+             "Too many keys to pack into a kscan event");
 
 struct zmk_kscan_event {
-    uint32_t row;
-    uint32_t column;
-    uint32_t state;
+    // Key position, with ZMK_KSCAN_EVENT_PRESSED set for a press.
+    uint32_t key;
+    // Uptime in milliseconds, truncated to 32 bits.
+    uint32_t timestamp;
+#if IS_ENABLED(CONFIG_ZMK_LATENCY_TRACING)
+    uint32_t trace_start;
+#endif
 };
 
-struct zmk_kscan_msg_processor {
-    struct k_work work;
-} msg_processor;
+// Single-producer, single-consumer queue. Events are only added by the kscan callback, which every
+// driver calls from one context at a time, and only removed by the work item.
+static struct zmk_kscan_event queue[QUEUE_SIZE];
+static atomic_t queue_head;
+static atomic_t queue_tail;
+
+// Set while releases are waiting in pending_releases. Every event from then on bypasses the queue
+// until the work item has raised them, so events are still raised in the order they happened.
+static atomic_t overflowing;
+// Releases which happened while the queue was full or overflowing.
+static ATOMIC_DEFINE(pending_releases, ZMK_KEYMAP_LEN);
+// Presses which were dropped, so their releases can be dropped too. Only used by the producer.
+static ATOMIC_DEFINE(dropped_presses, ZMK_KEYMAP_LEN);
+
+// Only written by the producer, and atomic so that they can be read from anywhere.
+static atomic_t dropped_presses_count;
+static atomic_t deferred_releases_count;
+static atomic_t high_water;
+
+static struct k_work process_work;
+
+static uint32_t queue_next(uint32_t index) { return index + 1 < QUEUE_INDEX_WRAP ? index + 1 : 0; }
+
+static uint32_t queue_len(uint32_t head, uint32_t tail) {
+    return head >= tail ? head - tail : head + QUEUE_INDEX_WRAP - tail;
+}
+
+static struct zmk_kscan_event *queue_slot(uint32_t index) {
+    return &queue[index < QUEUE_SIZE ? index : index - QUEUE_SIZE];
+}
+
+/**
+ * Handle an event which can't be added to the queue. Presses are dropped, but releases are kept, so
+ * a key can never get stuck down.
+ */
+static void zmk_kscan_overflow(uint32_t position, bool pressed) {
+    if (pressed) {
+        atomic_set_bit(dropped_presses, position);
+        atomic_inc(&dropped_presses_count);
+        return;
+    }
+
+    atomic_set_bit(pending_releases, position);
+    atomic_set(&overflowing, 1);
+    atomic_inc(&deferred_releases_count);
 
-K_MSGQ_DEFINE(zmk_kscan_msgq, sizeof(struct zmk_kscan_event), CONFIG_ZMK_KSCAN_EVENT_QUEUE_SIZE, 4);
+    k_work_submit(&process_work);
+}
 
 static void zmk_kscan_callback(const struct device *dev, uint32_t row, uint32_t column,
                                bool pressed) {
-    struct zmk_kscan_event ev = {
-        .row = row,
-        .column = column,
-        .state = (pressed ? ZMK_KSCAN_EVENT_STATE_PRESSED : ZMK_KSCAN_EVENT_STATE_RELEASED)};
+    const int32_t position = zmk_matrix_transform_row_column_to_position(row, column);
+
+    if (position < 0 || position >= ZMK_KEYMAP_LEN) {
+        LOG_WRN("Not found in transform: row: %d, col: %d, pressed: %s", row, column,
+                (pressed ? "true" : "false"));
+        return;
+    }
+
+    // A key whose press was dropped was never pressed as far as the keymap knows, so its release is
+    // dropped too, whether or not the queue has drained since.
+    if (!pressed && atomic_test_and_clear_bit(dropped_presses, position)) {
+        return;
+    }
+
+    const uint32_t head = atomic_get(&queue_head);
+    const uint32_t tail = atomic_get(&queue_tail);
+    const uint32_t len = queue_len(head, tail);
 
-    k_msgq_put(&zmk_kscan_msgq, &ev, K_NO_WAIT);
-    k_work_submit(&msg_processor.work);
+    if (len >= QUEUE_SIZE || atomic_get(&overflowing)) {
+        zmk_kscan_overflow(position, pressed);
+        return;
+    }
+
+    *queue_slot(head) = (struct zmk_kscan_event){
+        .key = position | (pressed ? ZMK_KSCAN_EVENT_PRESSED : 0),
+        .timestamp = k_uptime_get_32(),
+#if IS_ENABLED(CONFIG_ZMK_LATENCY_TRACING)
+        .trace_start = zmk_latency_now(),
+#endif
+    };
+
+    atomic_set(&queue_head, queue_next(head));
+
+    if (pressed) {
+        atomic_clear_bit(dropped_presses, position);
+    }
+
+    if (len + 1 > atomic_get(&high_water)) {
+        atomic_set(&high_water, len + 1);
+    }
+
+    // Only wake the work item if the queue was empty, as it otherwise still has events to raise and
+    // will find this one. The tail is read again after publishing the event, since the work item
+    // may have drained the queue after it was first read. Either the work item sees the new head
+    // when it checks for more events, or the tail read here shows it had already drained the queue.
+    if (atomic_get(&queue_tail) == head) {
+        k_work_submit(&process_work);
+    }
+}
+
+static void zmk_kscan_raise(uint32_t position, bool pressed, int64_t timestamp,
+                            uint32_t trace_start) {
+    LOG_DBG("Position: %d, pressed: %s", position, (pressed ? "true" : "false"));
+
+    zmk_latency_trace_begin(trace_start);
+    zmk_latency_record(ZMK_LATENCY_STAGE_KSCAN_QUEUE);
+    ZMK_EVENT_RAISE(new_zmk_position_state_changed(
+        (struct zmk_position_state_changed){.source = ZMK_POSITION_STATE_CHANGE_SOURCE_LOCAL,
+                                            .state = pressed,
+                                            .position = position,
+                                            .timestamp = timestamp}));
+    zmk_latency_trace_end();
 }
 
-void zmk_kscan_process_msgq(struct k_work *item) {
-    struct zmk_kscan_event ev;
+static void zmk_kscan_process_queue() {
+    uint32_t tail = atomic_get(&queue_tail);
 
-    while (k_msgq_get(&zmk_kscan_msgq, &ev, K_NO_WAIT) == 0) {
-        bool pressed = (ev.state == ZMK_KSCAN_EVENT_STATE_PRESSED);
-        int32_t position = zmk_matrix_transform_row_column_to_position(ev.row, ev.column);
+    // The head is checked again after each event's tail is published, so an event added just
+    // before the queue is found empty is never left without the work item being submitted.
+    while (tail != atomic_get(&queue_head)) {
+        const struct zmk_kscan_event ev = *queue_slot(tail);
 
-        if (position < 0) {
-            LOG_WRN("Not found in transform: row: %d, col: %d, pressed: %s", ev.row, ev.column,
-                    (pressed ? "true" : "false"));
-            continue;
+        tail = queue_next(tail);
+        atomic_set(&queue_tail, tail);
+
+        // Rebuild the full timestamp from the truncated one, which is always in the recent past.
+        const int64_t now = k_uptime_get();
+        const int64_t timestamp = now - (uint32_t)((uint32_t)now - ev.timestamp);
+
+        zmk_kscan_raise(ev.key & ZMK_KSCAN_EVENT_POSITION_MASK, ev.key & ZMK_KSCAN_EVENT_PRESSED,
+                        timestamp, COND_CODE_1(CONFIG_ZMK_LATENCY_TRACING, (ev.trace_start), (0)));
+    }
+}
+
+static void zmk_kscan_process_overflow() {
+    for (int i = 0; i < ZMK_KEYMAP_LEN; i++) {
+        if (atomic_test_and_clear_bit(pending_releases, i)) {
+            zmk_kscan_raise(i, false, k_uptime_get(), 0);
         }
+    }
+}
 
-        LOG_DBG("Row: %d, col: %d, position: %d, pressed: %s", ev.row, ev.column, position,
-                (pressed ? "true" : "false"));
-        ZMK_EVENT_RAISE(new_zmk_position_state_changed(
-            (struct zmk_position_state_changed){.source = ZMK_POSITION_STATE_CHANGE_SOURCE_LOCAL,
-                                                .state = pressed,
-                                                .position = position,
-                                                .timestamp = k_uptime_get()}));
+static void zmk_kscan_process_events(struct k_work *item) {
+    zmk_kscan_process_queue();
+
+    // Releases which didn't fit in the queue happened after everything which did, so raise them
+    // once the queue is empty. Events which arrive while doing so go back into the queue.
+    while (atomic_cas(&overflowing, 1, 0)) {
+        zmk_kscan_process_overflow();
+        zmk_kscan_process_queue();
     }
 }
 
+void zmk_kscan_get_stats(struct zmk_kscan_stats *result) {
+    *result = (struct zmk_kscan_stats){
+        .dropped_presses = atomic_get(&dropped_presses_count),
+        .deferred_releases = atomic_get(&deferred_releases_count),
+        .high_water = atomic_get(&high_water),
+    };
+}
+
 int zmk_kscan_init(const struct device *dev) {
     if (dev == NULL) {
         LOG_ERR("Failed to get the KSCAN device");
         return -EINVAL;
     }
 
-    k_work_init(&msg_processor.work, zmk_kscan_process_msgq);
+    k_work_init(&process_work, zmk_kscan_process_events);
 
     kscan_config(dev, zmk_kscan_callback);
     kscan_enable_callback(dev);
@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) 2023 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <string.h>
+#include <zephyr/device.h>
+#include <zephyr/init.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#if IS_ENABLED(CONFIG_TIMING_FUNCTIONS)
+#include <zephyr/timing/timing.h>
+#endif
+
+#if IS_ENABLED(CONFIG_SHELL)
+#include <zephyr/shell/shell.h>
+#endif
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#include <zmk/latency.h>
+
+#define BUCKET_COUNT CONFIG_ZMK_LATENCY_TRACING_HISTOGRAM_BUCKETS
+#define BUCKET_WIDTH_US CONFIG_ZMK_LATENCY_TRACING_HISTOGRAM_BUCKET_US
+
+struct stage_data {
+    struct zmk_latency_stats stats;
+    // The last bucket also counts every sample beyond the range of the histogram.
+    uint32_t histogram[BUCKET_COUNT];
+};
+
+static const char *stage_names[ZMK_LATENCY_STAGE_COUNT] = {
+    [ZMK_LATENCY_STAGE_KSCAN_QUEUE] = "kscan queue",
+    [ZMK_LATENCY_STAGE_POSITION_EVENT] = "position event",
+    [ZMK_LATENCY_STAGE_BEHAVIOR] = "behavior",
+    [ZMK_LATENCY_STAGE_KEYCODE_EVENT] = "keycode event",
+    [ZMK_LATENCY_STAGE_REPORT_QUEUED] = "report queued",
+    [ZMK_LATENCY_STAGE_REPORT_SENT] = "report sent",
+};
+
+static struct stage_data stages[ZMK_LATENCY_STAGE_COUNT];
+static struct k_spinlock lock;
+
+static uint32_t active_trace_start;
+
+uint32_t zmk_latency_now() {
+#if IS_ENABLED(CONFIG_TIMING_FUNCTIONS)
+    uint32_t now = (uint32_t)timing_counter_get();
+#else
+    uint32_t now = k_cycle_get_32();
+#endif
+
+    // 0 is reserved to mean "no trace".
+    return now != 0 ? now : 1;
+}
+
+static uint32_t cycles_to_us(uint32_t cycles) {
+#if IS_ENABLED(CONFIG_TIMING_FUNCTIONS)
+    return (uint32_t)(timing_cycles_to_ns(cycles) / NSEC_PER_USEC);
+#else
+    return k_cyc_to_us_floor32(cycles);
+#endif
+}
+
+void zmk_latency_trace_begin(uint32_t start) { active_trace_start = start; }
+
+void zmk_latency_trace_end() { active_trace_start = 0; }
+
+uint32_t zmk_latency_trace_start() { return active_trace_start; }
+
+void zmk_latency_record_from(enum zmk_latency_stage stage, uint32_t start) {
+    if (start == 0 || stage >= ZMK_LATENCY_STAGE_COUNT) {
+        return;
+    }
+
+    // Unsigned subtraction handles the counter wrapping around.
+    uint32_t elapsed_us = cycles_to_us(zmk_latency_now() - start);
+    uint32_t bucket = MIN(elapsed_us / BUCKET_WIDTH_US, BUCKET_COUNT - 1);
+
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    struct stage_data *data = &stages[stage];
+    if (data->stats.count == 0 || elapsed_us < data->stats.min_us) {
+        data->stats.min_us = elapsed_us;
+    }
+    if (elapsed_us > data->stats.max_us) {
+        data->stats.max_us = elapsed_us;
+    }
+    data->stats.count++;
+    data->stats.total_us += elapsed_us;
+    data->histogram[bucket]++;
+
+    k_spin_unlock(&lock, key);
+}
+
+void zmk_latency_record(enum zmk_latency_stage stage) {
+    zmk_latency_record_from(stage, active_trace_start);
+}
+
+int zmk_latency_get_stats(enum zmk_latency_stage stage, struct zmk_latency_stats *stats) {
+    if (stage >= ZMK_LATENCY_STAGE_COUNT) {
+        return -EINVAL;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    *stats = stages[stage].stats;
+    k_spin_unlock(&lock, key);
+
+    return 0;
+}
+
+// Returns the upper bound of the histogram bucket which contains the given percentile.
+uint32_t zmk_latency_get_percentile_us(enum zmk_latency_stage stage, uint8_t percentile) {
+    if (stage >= ZMK_LATENCY_STAGE_COUNT) {
+        return 0;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    const struct stage_data *data = &stages[stage];
+    uint32_t target = DIV_ROUND_UP((uint64_t)data->stats.count * percentile, 100);
+    uint32_t seen = 0;
+    uint32_t result = 0;
+
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        seen += data->histogram[i];
+        if (seen >= target) {
+            result = (i + 1) * BUCKET_WIDTH_US;
+            break;
+        }
+    }
+
+    k_spin_unlock(&lock, key);
+
+    return result;
+}
+
+void zmk_latency_reset() {
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    memset(stages, 0, sizeof(stages));
+    k_spin_unlock(&lock, key);
+}
+
+int zmk_latency_check_budget() {
+    if (CONFIG_ZMK_LATENCY_TRACING_BUDGET_US == 0) {
+        return 0;
+    }
+
+    struct zmk_latency_stats stats;
+    zmk_latency_get_stats(ZMK_LATENCY_STAGE_REPORT_SENT, &stats);
+    if (stats.count == 0) {
+        return -ENODATA;
+    }
+
+    // Percentiles are rounded up to a bucket boundary, so this errs on the side of failing.
+    if (zmk_latency_get_percentile_us(ZMK_LATENCY_STAGE_REPORT_SENT, 99) >
+        CONFIG_ZMK_LATENCY_TRACING_BUDGET_US) {
+        return -ETIME;
+    }
+
+    return 0;
+}
+
+#if CONFIG_ZMK_LATENCY_TRACING_LOG_INTERVAL > 0
+
+static void log_stats() {
+    for (int i = 0; i < ZMK_LATENCY_STAGE_COUNT; i++) {
+        struct zmk_latency_stats stats;
+        zmk_latency_get_stats(i, &stats);
+        if (stats.count == 0) {
+            continue;
+        }
+
+        LOG_INF("%s: count %d, min %dus, avg %dus, p99 %dus, max %dus", stage_names[i],
+                stats.count, stats.min_us, (uint32_t)(stats.total_us / stats.count),
+                zmk_latency_get_percentile_us(i, 99), stats.max_us);
+    }
+
+    if (zmk_latency_check_budget() == -ETIME) {
+        LOG_WRN("p99 report latency %dus exceeds the budget of %dus",
+                zmk_latency_get_percentile_us(ZMK_LATENCY_STAGE_REPORT_SENT, 99),
+                CONFIG_ZMK_LATENCY_TRACING_BUDGET_US);
+    }
+}
+
+static void log_stats_work_handler(struct k_work *work);
+
+static K_WORK_DELAYABLE_DEFINE(log_stats_work, log_stats_work_handler);
+
+static void log_stats_work_handler(struct k_work *work) {
+    log_stats();
+    k_work_schedule(&log_stats_work, K_SECONDS(CONFIG_ZMK_LATENCY_TRACING_LOG_INTERVAL));
+}
+
+#endif /* CONFIG_ZMK_LATENCY_TRACING_LOG_INTERVAL > 0 */
+
+#if IS_ENABLED(CONFIG_SHELL)
+
+static int cmd_latency_show(const struct shell *sh, size_t argc, char **argv) {
+    shell_print(sh, "%-16s %8s %8s %8s %8s %8s", "stage", "count", "min us", "avg us", "p99 us",
+                "max us");
+
+    for (int i = 0; i < ZMK_LATENCY_STAGE_COUNT; i++) {
+        struct zmk_latency_stats stats;
+        zmk_latency_get_stats(i, &stats);
+
+        shell_print(sh, "%-16s %8u %8u %8u %8u %8u", stage_names[i], stats.count, stats.min_us,
+                    stats.count > 0 ? (uint32_t)(stats.total_us / stats.count) : 0,
+                    zmk_latency_get_percentile_us(i, 99), stats.max_us);
+    }
+
+    return 0;
+}
+
+static int cmd_latency_histogram(const struct shell *sh, size_t argc, char **argv) {
+    for (int i = 0; i < ZMK_LATENCY_STAGE_COUNT; i++) {
+        k_spinlock_key_t key = k_spin_lock(&lock);
+        struct stage_data data = stages[i];
+        k_spin_unlock(&lock, key);
+
+        if (data.stats.count == 0) {
+            continue;
+        }
+
+        shell_print(sh, "%s:", stage_names[i]);
+        for (int bucket = 0; bucket < BUCKET_COUNT; bucket++) {
+            if (data.histogram[bucket] > 0) {
+                shell_print(sh, "  < %6uus: %u", (bucket + 1) * BUCKET_WIDTH_US,
+                            data.histogram[bucket]);
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int cmd_latency_budget(const struct shell *sh, size_t argc, char **argv) {
+    uint32_t p50 = zmk_latency_get_percentile_us(ZMK_LATENCY_STAGE_REPORT_SENT, 50);
+    uint32_t p99 = zmk_latency_get_percentile_us(ZMK_LATENCY_STAGE_REPORT_SENT, 99);
+
+    switch (zmk_latency_check_budget()) {
+    case -ENODATA:
+        shell_print(sh, "No reports traced yet");
+        return -ENODATA;
+    case -ETIME:
+        shell_print(sh, "FAIL: p50 %uus, p99 %uus, budget %uus", p50, p99,
+                    CONFIG_ZMK_LATENCY_TRACING_BUDGET_US);
+        return -ETIME;
+    default:
+        if (CONFIG_ZMK_LATENCY_TRACING_BUDGET_US == 0) {
+            shell_print(sh, "No budget set: p50 %uus, p99 %uus", p50, p99);
+        } else {
+            shell_print(sh, "PASS: p50 %uus, p99 %uus, budget %uus", p50, p99,
+                        CONFIG_ZMK_LATENCY_TRACING_BUDGET_US);
+        }
+        return 0;
+    }
+}
+
+static int cmd_latency_reset(const struct shell *sh, size_t argc, char **argv) {
+    zmk_latency_reset();
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_latency,
+                               SHELL_CMD(show, NULL, "Show latency per stage", cmd_latency_show),
+                               SHELL_CMD(histogram, NULL, "Show latency histograms",
+                                         cmd_latency_histogram),
+                               SHELL_CMD(budget, NULL, "Check report latency against the budget",
+                                         cmd_latency_budget),
+                               SHELL_CMD(reset, NULL, "Reset latency statistics",
+                                         cmd_latency_reset),
+                               SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(latency, &sub_latency, "Keypress latency statistics", NULL);
+
+#endif /* IS_ENABLED(CONFIG_SHELL) */
+
+static int zmk_latency_init(const struct device *_arg) {
+#if IS_ENABLED(CONFIG_TIMING_FUNCTIONS)
+    timing_init();
+    timing_start();
+#endif
+
+#if CONFIG_ZMK_LATENCY_TRACING_LOG_INTERVAL > 0
+    k_work_schedule(&log_stats_work, K_SECONDS(CONFIG_ZMK_LATENCY_TRACING_LOG_INTERVAL));
+#endif
+
+    return 0;
+}
+
+SYS_INIT(zmk_latency_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
@@ -87,6 +87,12 @@ static void trigger_sensor_data_for_position(uint32_t sensor_index) {
         return;
     }
 
+    // Nothing to report if the movement since the last sample cancelled out, which happens when
+    // a sensor adds up its movement over a report interval.
+    if (value.val1 == 0 && value.val2 == 0) {
+        return;
+    }
+
     ZMK_EVENT_RAISE(new_zmk_sensor_event(
         (struct zmk_sensor_event){.sensor_index = item->sensor_index,
                                   .channel_data_size = 1,
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2023 The ZMK Contributors
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <string.h>
+
+#include <zephyr/device.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/init.h>
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
+
+#include <zmk/behavior.h>
+#include <zmk/split/bluetooth/service.h>
+
+// Both halves build the table from the same devicetree nodes in the same order, so a behavior has
+// the same ID on each half as long as they are built from the same keymap.
+#define BEHAVIOR_LABEL(node)                                                                       \
+    COND_CODE_1(DT_NODE_HAS_PROP(node, label), (DT_PROP(node, label), ), ())
+
+#define BEHAVIOR_LABELS(path)                                                                      \
+    COND_CODE_1(DT_NODE_EXISTS(DT_PATH(path)),                                                     \
+                (DT_FOREACH_CHILD_STATUS_OKAY(DT_PATH(path), BEHAVIOR_LABEL)), ())
+
+static const char *const behavior_labels[] = {BEHAVIOR_LABELS(behaviors) BEHAVIOR_LABELS(macros)};
+
+BUILD_ASSERT(ARRAY_SIZE(behavior_labels) < ZMK_SPLIT_BT_BEHAVIOR_ID_INVALID,
+             "Too many behaviors to identify with a single byte");
+
+static const struct device *behavior_devices[ARRAY_SIZE(behavior_labels)];
+static bool behavior_devices_resolved;
+
+// Behaviors are only looked up by ID once the keyboard is running, by when every behavior device
+// has been initialized. Resolving them in this file's SYS_INIT instead would miss behaviors defined
+// at the same init level and priority but initialized after it.
+static void resolve_behavior_devices() {
+    if (behavior_devices_resolved) {
+        return;
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(behavior_labels); i++) {
+        // Behaviors which aren't built on this half have no device, and are never sent by ID.
+        behavior_devices[i] = device_get_binding(behavior_labels[i]);
+    }
+
+    // Lookups from the Bluetooth and keymap threads may race to resolve the table, which only
+    // writes the same devices twice, as long as the flag isn't set before them.
+    compiler_barrier();
+    behavior_devices_resolved = true;
+}
+
+static uint32_t behavior_table_hash;
+
+uint32_t zmk_split_bt_behavior_table_hash() { return behavior_table_hash; }
+
+uint8_t zmk_split_bt_behavior_id(const struct zmk_behavior_binding *binding) {
+    const struct device *dev = zmk_behavior_get_binding_device(binding);
+    if (dev == NULL) {
+        return ZMK_SPLIT_BT_BEHAVIOR_ID_INVALID;
+    }
+
+    resolve_behavior_devices();
+
+    for (int i = 0; i < ARRAY_SIZE(behavior_devices); i++) {
+        if (behavior_devices[i] == dev) {
+            return i;
+        }
+    }
+
+    return ZMK_SPLIT_BT_BEHAVIOR_ID_INVALID;
+}
+
+const struct device *zmk_split_bt_behavior_by_id(uint8_t id) {
+    if (id >= ARRAY_SIZE(behavior_devices)) {
+        return NULL;
+    }
+
+    resolve_behavior_devices();
+
+    return behavior_devices[id];
+}
+
+static int zmk_split_bt_behavior_ids_init(const struct device *_arg) {
+    // FNV-1a over every label, including its terminator, so that the two halves can detect when
+    // their tables do not match.
+    uint32_t hash = 2166136261U;
+
+    for (int i = 0; i < ARRAY_SIZE(behavior_labels); i++) {
+        const char *label = behavior_labels[i];
+
+        for (size_t j = 0; j <= strlen(label); j++) {
+            hash = (hash ^ (uint8_t)label[j]) * 16777619U;
+        }
+    }
+
+    behavior_table_hash = hash;
+
+    LOG_DBG("%d behavior IDs, table hash 0x%08x", ARRAY_SIZE(behavior_labels), hash);
+
+    return 0;
+}
+
+SYS_INIT(zmk_split_bt_behavior_ids_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
@@ -16,12 +16,17 @@
 
 #include <zephyr/logging/log.h>
 
+#if IS_ENABLED(CONFIG_SHELL)
+#include <zephyr/shell/shell.h>
+#endif
+
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
 #include <zmk/stdlib.h>
 #include <zmk/ble.h>
 #include <zmk/behavior.h>
 #include <zmk/sensors.h>
+#include <zmk/split/bluetooth/central.h>
 #include <zmk/split/bluetooth/uuid.h>
 #include <zmk/split/bluetooth/service.h>
 #include <zmk/event_manager.h>
@@ -30,7 +35,25 @@ LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
 static int start_scanning(void);
 
-#define POSITION_STATE_DATA_LEN 16
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_POSITION_CHANGES)
+#define CLOCK_SYNC_WINDOW_MS 10000
+
+struct peripheral_clock {
+    bool synced;
+    // Central uptime minus peripheral uptime, plus the shortest delay seen for a notification.
+    uint32_t offset;
+    // Smallest offset seen since window_start.
+    uint32_t window_min;
+    int64_t window_start;
+};
+#endif
+
+struct zmk_split_run_behavior_payload_wrapper {
+    struct zmk_split_run_behavior_payload payload;
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_BEHAVIOR_IDS)
+    uint8_t behavior_id;
+#endif
+};
 
 enum peripheral_slot_state {
     PERIPHERAL_SLOT_STATE_OPEN,
@@ -44,14 +67,33 @@ struct peripheral_slot {
     struct bt_gatt_discover_params discover_params;
     struct bt_gatt_subscribe_params subscribe_params;
     struct bt_gatt_subscribe_params sensor_subscribe_params;
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_POSITION_CHANGES)
+    struct bt_gatt_subscribe_params changes_subscribe_params;
+    struct peripheral_clock clock;
+#endif
     struct bt_gatt_discover_params sub_discover_params;
     uint16_t run_behavior_handle;
-    uint8_t position_state[POSITION_STATE_DATA_LEN];
-    uint8_t changed_positions[POSITION_STATE_DATA_LEN];
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_BEHAVIOR_IDS)
+    uint16_t run_behavior_id_handle;
+    struct bt_gatt_read_params behavior_table_read_params;
+    // Set once the peripheral's behavior ID table is confirmed to match ours.
+    bool behavior_ids_match;
+#endif
+    uint8_t position_state[ZMK_SPLIT_POS_STATE_LEN];
+    uint8_t changed_positions[ZMK_SPLIT_POS_STATE_LEN];
+    // Behaviors waiting to be sent to this peripheral, so a slow link doesn't delay the others.
+    struct k_msgq run_behavior_msgq;
+    char __aligned(4)
+        run_behavior_msgq_buffer[CONFIG_ZMK_SPLIT_BLE_CENTRAL_SPLIT_RUN_QUEUE_SIZE *
+                                 sizeof(struct zmk_split_run_behavior_payload_wrapper)];
+    struct zmk_split_peripheral_stats stats;
 };
 
 static struct peripheral_slot peripherals[ZMK_SPLIT_BLE_PERIPHERAL_COUNT];
 
+// Index into peripherals for each connection by bt_conn_index(), or -1 if it's not a peripheral.
+static int8_t slot_index_by_conn[CONFIG_BT_MAX_CONN];
+
 static bool is_scanning = false;
 
 static const struct bt_uuid_128 split_service_uuid = BT_UUID_INIT_128(ZMK_SPLIT_BT_SERVICE_UUID);
@@ -69,14 +111,25 @@ void peripheral_event_work_callback(struct k_work *work) {
 
 K_WORK_DEFINE(peripheral_event_work, peripheral_event_work_callback);
 
+static bool queue_peripheral_event(struct peripheral_slot *slot,
+                                   const struct zmk_position_state_changed *ev) {
+    if (k_msgq_put(&peripheral_event_msgq, ev, K_NO_WAIT) != 0) {
+        LOG_WRN("Peripheral event queue full, dropping change of position %d", ev->position);
+        slot->stats.position_events_dropped++;
+        return false;
+    }
+
+    slot->stats.position_events++;
+    return true;
+}
+
 int peripheral_slot_index_for_conn(struct bt_conn *conn) {
-    for (int i = 0; i < ZMK_SPLIT_BLE_PERIPHERAL_COUNT; i++) {
-        if (peripherals[i].conn == conn) {
-            return i;
-        }
+    const uint8_t conn_idx = bt_conn_index(conn);
+    if (conn_idx >= ARRAY_SIZE(slot_index_by_conn) || slot_index_by_conn[conn_idx] < 0) {
+        return -EINVAL;
     }
 
-    return -EINVAL;
+    return slot_index_by_conn[conn_idx];
 }
 
 struct peripheral_slot *peripheral_slot_for_conn(struct bt_conn *conn) {
@@ -102,13 +155,15 @@ int release_peripheral_slot(int index) {
     LOG_DBG("Releasing peripheral slot at %d", index);
 
     if (slot->conn != NULL) {
+        slot_index_by_conn[bt_conn_index(slot->conn)] = -1;
         bt_conn_unref(slot->conn);
         slot->conn = NULL;
     }
     slot->state = PERIPHERAL_SLOT_STATE_OPEN;
+    k_msgq_purge(&slot->run_behavior_msgq);
 
     // Raise events releasing any active positions from this peripheral
-    for (int i = 0; i < POSITION_STATE_DATA_LEN; i++) {
+    for (int i = 0; i < ZMK_SPLIT_POS_STATE_LEN; i++) {
         for (int j = 0; j < 8; j++) {
             if (slot->position_state[i] & BIT(j)) {
                 uint32_t position = (i * 8) + j;
@@ -117,13 +172,13 @@ int release_peripheral_slot(int index) {
                                                         .state = false,
                                                         .timestamp = k_uptime_get()};
 
-                k_msgq_put(&peripheral_event_msgq, &ev, K_NO_WAIT);
+                queue_peripheral_event(slot, &ev);
                 k_work_submit(&peripheral_event_work);
             }
         }
     }
 
-    for (int i = 0; i < POSITION_STATE_DATA_LEN; i++) {
+    for (int i = 0; i < ZMK_SPLIT_POS_STATE_LEN; i++) {
         slot->position_state[i] = 0U;
         slot->changed_positions[i] = 0U;
     }
@@ -131,6 +186,14 @@ int release_peripheral_slot(int index) {
     // Clean up previously discovered handles;
     slot->subscribe_params.value_handle = 0;
     slot->run_behavior_handle = 0;
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_POSITION_CHANGES)
+    slot->changes_subscribe_params.value_handle = 0;
+    slot->clock = (struct peripheral_clock){0};
+#endif
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_BEHAVIOR_IDS)
+    slot->run_behavior_id_handle = 0;
+    slot->behavior_ids_match = false;
+#endif
 
     return 0;
 }
@@ -165,6 +228,7 @@ int confirm_peripheral_slot_conn(struct bt_conn *conn) {
     }
 
     peripherals[idx].state = PERIPHERAL_SLOT_STATE_CONNECTED;
+    peripherals[idx].stats = (struct zmk_split_peripheral_stats){0};
     return 0;
 }
 
@@ -232,31 +296,201 @@ static uint8_t split_central_notify_func(struct bt_conn *conn,
 
     LOG_DBG("[NOTIFICATION] data %p length %u", data, length);
 
-    for (int i = 0; i < POSITION_STATE_DATA_LEN; i++) {
+    // Peripherals with fewer key positions may send a shorter state.
+    const size_t state_len = MIN(length, ZMK_SPLIT_POS_STATE_LEN);
+
+    for (int i = 0; i < state_len; i++) {
         slot->changed_positions[i] = ((uint8_t *)data)[i] ^ slot->position_state[i];
         slot->position_state[i] = ((uint8_t *)data)[i];
         LOG_DBG("data: %d", slot->position_state[i]);
     }
 
-    for (int i = 0; i < POSITION_STATE_DATA_LEN; i++) {
+    const int source = peripheral_slot_index_for_conn(conn);
+    const int64_t timestamp = k_uptime_get();
+    bool queued = false;
+
+    for (int i = 0; i < state_len; i++) {
         for (int j = 0; j < 8; j++) {
             if (slot->changed_positions[i] & BIT(j)) {
                 uint32_t position = (i * 8) + j;
                 bool pressed = slot->position_state[i] & BIT(j);
-                struct zmk_position_state_changed ev = {.source =
-                                                            peripheral_slot_index_for_conn(conn),
+                struct zmk_position_state_changed ev = {.source = source,
                                                         .position = position,
                                                         .state = pressed,
-                                                        .timestamp = k_uptime_get()};
+                                                        .timestamp = timestamp};
 
-                k_msgq_put(&peripheral_event_msgq, &ev, K_NO_WAIT);
-                k_work_submit(&peripheral_event_work);
+                queued |= queue_peripheral_event(slot, &ev);
             }
         }
     }
 
+    if (queued) {
+        k_work_submit(&peripheral_event_work);
+    }
+
+    return BT_GATT_ITER_CONTINUE;
+}
+
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_POSITION_CHANGES)
+/**
+ * Translate a peripheral timestamp into central time.
+ *
+ * The notification which was delayed least by the link gives the smallest difference between the
+ * time it was received and the peripheral timestamp it carries, so that difference is used as the
+ * offset between the clocks. The offset is replaced by the smallest difference seen in each window
+ * so that it follows any drift between the clocks. Timestamps are compared modulo 2^32, so the
+ * truncated peripheral uptime can wrap around.
+ */
+static int64_t peripheral_time_to_central(struct peripheral_clock *clock, uint32_t peripheral_time,
+                                          int64_t now) {
+    const uint32_t sample = (uint32_t)now - peripheral_time;
+
+    if (!clock->synced) {
+        *clock = (struct peripheral_clock){
+            .synced = true,
+            .offset = sample,
+            .window_min = sample,
+            .window_start = now,
+        };
+    }
+
+    if ((int32_t)(sample - clock->window_min) < 0) {
+        clock->window_min = sample;
+    }
+
+    if ((int32_t)(sample - clock->offset) < 0) {
+        clock->offset = sample;
+    }
+
+    if (now - clock->window_start >= CLOCK_SYNC_WINDOW_MS) {
+        clock->offset = clock->window_min;
+        clock->window_min = sample;
+        clock->window_start = now;
+    }
+
+    return now - (int32_t)(sample - clock->offset);
+}
+
+static void update_link_delay_stats(struct peripheral_slot *slot, int64_t newest, int64_t now) {
+    const uint32_t delay_ms = now - newest;
+
+    slot->stats.link_delay_ms = delay_ms;
+    slot->stats.max_link_delay_ms = MAX(slot->stats.max_link_delay_ms, delay_ms);
+}
+
+static uint8_t split_central_position_changes_notify_func(struct bt_conn *conn,
+                                                          struct bt_gatt_subscribe_params *params,
+                                                          const void *data, uint16_t length) {
+    struct peripheral_slot *slot = peripheral_slot_for_conn(conn);
+
+    if (slot == NULL) {
+        LOG_ERR("No peripheral state found for connection");
+        return BT_GATT_ITER_CONTINUE;
+    }
+
+    if (!data) {
+        LOG_DBG("[UNSUBSCRIBED]");
+        params->value_handle = 0U;
+        return BT_GATT_ITER_STOP;
+    }
+
+    LOG_DBG("[POSITION CHANGES NOTIFICATION] data %p length %u", data, length);
+
+    if (length < sizeof(struct zmk_split_position_changes_header)) {
+        LOG_WRN("Ignoring position changes notify with insufficient data length (%d)", length);
+        return BT_GATT_ITER_CONTINUE;
+    }
+
+    struct zmk_split_position_changes_header header;
+    memcpy(&header, data, sizeof(header));
+
+    const uint8_t *changes = (const uint8_t *)data + sizeof(header);
+    const size_t count = (length - sizeof(header)) / sizeof(struct zmk_split_position_change);
+    const int source = peripheral_slot_index_for_conn(conn);
+    const int64_t now = k_uptime_get();
+    const int64_t newest = peripheral_time_to_central(&slot->clock, header.timestamp, now);
+    bool queued = false;
+
+    update_link_delay_stats(slot, newest, now);
+
+    for (int i = 0; i < count; i++) {
+        struct zmk_split_position_change change;
+        memcpy(&change, changes + (i * sizeof(change)), sizeof(change));
+
+        const uint32_t position = change.position & ~ZMK_SPLIT_POSITION_CHANGE_PRESSED;
+        const bool pressed = change.position & ZMK_SPLIT_POSITION_CHANGE_PRESSED;
+
+        if (position >= ZMK_SPLIT_POS_STATE_LEN * 8) {
+            LOG_WRN("Ignoring change of out of range position %d", position);
+            continue;
+        }
+
+        // Positions resent after the peripheral's queue overflowed may not have changed.
+        if (pressed == ((slot->position_state[position / 8] & BIT(position % 8)) != 0)) {
+            continue;
+        }
+
+        WRITE_BIT(slot->position_state[position / 8], position % 8, pressed);
+
+        struct zmk_position_state_changed ev = {.source = source,
+                                                .position = position,
+                                                .state = pressed,
+                                                .timestamp = newest - change.age};
+
+        queued |= queue_peripheral_event(slot, &ev);
+    }
+
+    if (queued) {
+        k_work_submit(&peripheral_event_work);
+    }
+
     return BT_GATT_ITER_CONTINUE;
 }
+#endif /* IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_POSITION_CHANGES) */
+
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_BEHAVIOR_IDS)
+static uint8_t split_central_behavior_table_read_func(struct bt_conn *conn, uint8_t err,
+                                                      struct bt_gatt_read_params *params,
+                                                      const void *data, uint16_t length) {
+    struct peripheral_slot *slot = peripheral_slot_for_conn(conn);
+    if (slot == NULL) {
+        return BT_GATT_ITER_STOP;
+    }
+
+    if (err) {
+        LOG_WRN("Failed to read peripheral behavior ID table (err %d)", err);
+        return BT_GATT_ITER_STOP;
+    }
+
+    // Called once more with no data when the read completes.
+    if (data == NULL || length != sizeof(uint32_t)) {
+        return BT_GATT_ITER_STOP;
+    }
+
+    const uint32_t hash = sys_get_le32(data);
+    slot->behavior_ids_match = hash == zmk_split_bt_behavior_table_hash();
+
+    if (!slot->behavior_ids_match) {
+        LOG_WRN("Peripheral behavior ID table 0x%08x does not match 0x%08x. Invoking behaviors by "
+                "name instead.",
+                hash, zmk_split_bt_behavior_table_hash());
+    }
+
+    return BT_GATT_ITER_STOP;
+}
+
+static void split_central_read_behavior_table(struct bt_conn *conn, struct peripheral_slot *slot) {
+    slot->behavior_table_read_params.func = split_central_behavior_table_read_func;
+    slot->behavior_table_read_params.handle_count = 1;
+    slot->behavior_table_read_params.single.handle = slot->run_behavior_id_handle;
+    slot->behavior_table_read_params.single.offset = 0;
+
+    int err = bt_gatt_read(conn, &slot->behavior_table_read_params);
+    if (err) {
+        LOG_ERR("Failed to read peripheral behavior ID table (err %d)", err);
+    }
+}
+#endif /* IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_BEHAVIOR_IDS) */
 
 static int split_central_subscribe(struct bt_conn *conn, struct bt_gatt_subscribe_params *params) {
     int err = bt_gatt_subscribe(conn, params);
@@ -275,11 +509,28 @@ static int split_central_subscribe(struct bt_conn *conn, struct bt_gatt_subscrib
     return err;
 }
 
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_POSITION_CHANGES)
+// Subscribes to the full position state of peripherals which can't send position changes.
+static void split_central_subscribe_position_state_fallback(struct bt_conn *conn) {
+    struct peripheral_slot *slot = peripheral_slot_for_conn(conn);
+    if (slot == NULL || slot->changes_subscribe_params.value_handle ||
+        !slot->subscribe_params.value_handle) {
+        return;
+    }
+
+    LOG_DBG("Peripheral can't send position changes, subscribing to position state");
+    split_central_subscribe(conn, &slot->subscribe_params);
+}
+#endif /* IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_POSITION_CHANGES) */
+
 static uint8_t split_central_chrc_discovery_func(struct bt_conn *conn,
                                                  const struct bt_gatt_attr *attr,
                                                  struct bt_gatt_discover_params *params) {
     if (!attr) {
         LOG_DBG("Discover complete");
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_POSITION_CHANGES)
+        split_central_subscribe_position_state_fallback(conn);
+#endif
         return BT_GATT_ITER_STOP;
     }
 
@@ -308,7 +559,26 @@ static uint8_t split_central_chrc_discovery_func(struct bt_conn *conn,
         slot->subscribe_params.value_handle = bt_gatt_attr_value_handle(attr);
         slot->subscribe_params.notify = split_central_notify_func;
         slot->subscribe_params.value = BT_GATT_CCC_NOTIFY;
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_POSITION_CHANGES)
+        // Only subscribed once discovery shows the peripheral can't send position changes.
+#else
         split_central_subscribe(conn, &slot->subscribe_params);
+#endif
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_POSITION_CHANGES)
+    } else if (bt_uuid_cmp(chrc_uuid,
+                           BT_UUID_DECLARE_128(ZMK_SPLIT_BT_CHAR_POSITION_CHANGES_UUID)) == 0) {
+        LOG_DBG("Found position changes characteristic");
+        slot->discover_params.uuid = NULL;
+        slot->discover_params.start_handle = attr->handle + 2;
+        slot->discover_params.type = BT_GATT_DISCOVER_CHARACTERISTIC;
+
+        slot->changes_subscribe_params.disc_params = &slot->sub_discover_params;
+        slot->changes_subscribe_params.end_handle = slot->discover_params.end_handle;
+        slot->changes_subscribe_params.value_handle = bt_gatt_attr_value_handle(attr);
+        slot->changes_subscribe_params.notify = split_central_position_changes_notify_func;
+        slot->changes_subscribe_params.value = BT_GATT_CCC_NOTIFY;
+        split_central_subscribe(conn, &slot->changes_subscribe_params);
+#endif /* IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_POSITION_CHANGES) */
 #if ZMK_KEYMAP_HAS_SENSORS
     } else if (bt_uuid_cmp(chrc_uuid, BT_UUID_DECLARE_128(ZMK_SPLIT_BT_CHAR_SENSOR_STATE_UUID)) ==
                0) {
@@ -329,12 +599,29 @@ static uint8_t split_central_chrc_discovery_func(struct bt_conn *conn,
         slot->discover_params.uuid = NULL;
         slot->discover_params.start_handle = attr->handle + 2;
         slot->run_behavior_handle = bt_gatt_attr_value_handle(attr);
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_BEHAVIOR_IDS)
+    } else if (bt_uuid_cmp(chrc_uuid,
+                           BT_UUID_DECLARE_128(ZMK_SPLIT_BT_CHAR_RUN_BEHAVIOR_ID_UUID)) == 0) {
+        LOG_DBG("Found run behavior ID handle");
+        slot->discover_params.uuid = NULL;
+        slot->discover_params.start_handle = attr->handle + 2;
+        slot->run_behavior_id_handle = bt_gatt_attr_value_handle(attr);
+        split_central_read_behavior_table(conn, slot);
+#endif /* IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_BEHAVIOR_IDS) */
     }
 
     bool subscribed = slot->run_behavior_handle && slot->subscribe_params.value_handle;
 #if ZMK_KEYMAP_HAS_SENSORS
     subscribed = subscribed && slot->sensor_subscribe_params.value_handle;
 #endif /* ZMK_KEYMAP_HAS_SENSORS */
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_BEHAVIOR_IDS)
+    // Peripherals without behavior IDs don't have this, so discovery runs to the end for them.
+    subscribed = subscribed && slot->run_behavior_id_handle;
+#endif
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_POSITION_CHANGES)
+    // As above, this runs discovery to the end for peripherals which can't send position changes.
+    subscribed = subscribed && slot->changes_subscribe_params.value_handle;
+#endif
 
     return subscribed ? BT_GATT_ITER_STOP : BT_GATT_ITER_CONTINUE;
 }
@@ -458,8 +745,11 @@ static bool split_central_eir_found(const bt_addr_le_t *addr) {
         LOG_ERR("Create conn failed (err %d) (create conn? 0x%04x)", err, BT_HCI_OP_LE_CREATE_CONN);
         release_peripheral_slot(slot_idx);
         start_scanning();
+        return false;
     }
 
+    slot_index_by_conn[bt_conn_index(slot->conn)] = slot_idx;
+
     return false;
 }
 
@@ -605,55 +895,79 @@ K_THREAD_STACK_DEFINE(split_central_split_run_q_stack,
 
 struct k_work_q split_central_split_run_q;
 
-struct zmk_split_run_behavior_payload_wrapper {
-    uint8_t source;
-    struct zmk_split_run_behavior_payload payload;
-};
-
-K_MSGQ_DEFINE(zmk_split_central_split_run_msgq,
-              sizeof(struct zmk_split_run_behavior_payload_wrapper),
-              CONFIG_ZMK_SPLIT_BLE_CENTRAL_SPLIT_RUN_QUEUE_SIZE, 4);
-
 void split_central_split_run_callback(struct k_work *work) {
     struct zmk_split_run_behavior_payload_wrapper payload_wrapper;
 
     LOG_DBG("");
 
-    while (k_msgq_get(&zmk_split_central_split_run_msgq, &payload_wrapper, K_NO_WAIT) == 0) {
-        if (peripherals[payload_wrapper.source].state != PERIPHERAL_SLOT_STATE_CONNECTED) {
-            LOG_ERR("Source not connected");
-            continue;
-        }
-        if (!peripherals[payload_wrapper.source].run_behavior_handle) {
-            LOG_ERR("Run behavior handle not found");
-            continue;
-        }
+    for (int i = 0; i < ZMK_SPLIT_BLE_PERIPHERAL_COUNT; i++) {
+        struct peripheral_slot *slot = &peripherals[i];
 
-        int err = bt_gatt_write_without_response(
-            peripherals[payload_wrapper.source].conn,
-            peripherals[payload_wrapper.source].run_behavior_handle, &payload_wrapper.payload,
-            sizeof(struct zmk_split_run_behavior_payload), true);
+        while (k_msgq_get(&slot->run_behavior_msgq, &payload_wrapper, K_NO_WAIT) == 0) {
+            if (slot->state != PERIPHERAL_SLOT_STATE_CONNECTED) {
+                LOG_ERR("Source not connected");
+                continue;
+            }
 
-        if (err) {
-            LOG_ERR("Failed to write the behavior characteristic (err %d)", err);
+            int err;
+
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_BEHAVIOR_IDS)
+            if (slot->behavior_ids_match &&
+                payload_wrapper.behavior_id != ZMK_SPLIT_BT_BEHAVIOR_ID_INVALID) {
+                struct zmk_split_run_behavior_id_payload payload = {
+                    .behavior_id = payload_wrapper.behavior_id,
+                    .data = payload_wrapper.payload.data,
+                };
+
+                err = bt_gatt_write_without_response(slot->conn, slot->run_behavior_id_handle,
+                                                     &payload, sizeof(payload), true);
+                if (err) {
+                    LOG_ERR("Failed to write the behavior ID characteristic (err %d)", err);
+                    slot->stats.behaviors_dropped++;
+                } else {
+                    slot->stats.behaviors_sent++;
+                }
+                continue;
+            }
+#endif /* IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_BEHAVIOR_IDS) */
+
+            if (!slot->run_behavior_handle) {
+                LOG_ERR("Run behavior handle not found");
+                slot->stats.behaviors_dropped++;
+                continue;
+            }
+
+            err = bt_gatt_write_without_response(
+                slot->conn, slot->run_behavior_handle, &payload_wrapper.payload,
+                sizeof(struct zmk_split_run_behavior_payload), true);
+
+            if (err) {
+                LOG_ERR("Failed to write the behavior characteristic (err %d)", err);
+                slot->stats.behaviors_dropped++;
+            } else {
+                slot->stats.behaviors_sent++;
+            }
         }
     }
 }
 
 K_WORK_DEFINE(split_central_split_run_work, split_central_split_run_callback);
 
-static int
-split_bt_invoke_behavior_payload(struct zmk_split_run_behavior_payload_wrapper payload_wrapper) {
-    LOG_DBG("");
-
-    int err = k_msgq_put(&zmk_split_central_split_run_msgq, &payload_wrapper, K_MSEC(100));
+static int split_bt_queue_behavior_payload(
+    struct peripheral_slot *slot,
+    const struct zmk_split_run_behavior_payload_wrapper *payload_wrapper) {
+    // Never block here. This runs on the keymap's thread, once for every connected peripheral for
+    // a global behavior, so waiting for one slow peripheral would delay every other key event.
+    int err = k_msgq_put(&slot->run_behavior_msgq, payload_wrapper, K_NO_WAIT);
     if (err) {
         switch (err) {
-        case -EAGAIN: {
-            LOG_WRN("Consumer message queue full, popping first message and queueing again");
-            struct zmk_split_run_behavior_payload_wrapper discarded_report;
-            k_msgq_get(&zmk_split_central_split_run_msgq, &discarded_report, K_NO_WAIT);
-            return split_bt_invoke_behavior_payload(payload_wrapper);
+        case -ENOMSG: {
+            LOG_WRN("Behavior queue for peripheral %d full, dropping the oldest behavior",
+                    (int)(slot - peripherals));
+            struct zmk_split_run_behavior_payload_wrapper discarded_payload;
+            k_msgq_get(&slot->run_behavior_msgq, &discarded_payload, K_NO_WAIT);
+            slot->stats.behaviors_dropped++;
+            return split_bt_queue_behavior_payload(slot, payload_wrapper);
         }
         default:
             LOG_WRN("Failed to queue behavior to send (%d)", err);
@@ -661,31 +975,133 @@ split_bt_invoke_behavior_payload(struct zmk_split_run_behavior_payload_wrapper p
         }
     }
 
-    k_work_submit_to_queue(&split_central_split_run_q, &split_central_split_run_work);
+    slot->stats.behavior_queue_high_water = MAX(slot->stats.behavior_queue_high_water,
+                                                k_msgq_num_used_get(&slot->run_behavior_msgq));
 
     return 0;
 };
 
-int zmk_split_bt_invoke_behavior(uint8_t source, struct zmk_behavior_binding *binding,
-                                 struct zmk_behavior_binding_event event, bool state) {
-    struct zmk_split_run_behavior_payload payload = {.data = {
-                                                         .param1 = binding->param1,
-                                                         .param2 = binding->param2,
-                                                         .position = event.position,
-                                                         .state = state ? 1 : 0,
-                                                     }};
-    const size_t payload_dev_size = sizeof(payload.behavior_dev);
-    if (strlcpy(payload.behavior_dev, binding->behavior_dev, payload_dev_size) >=
+static struct zmk_split_run_behavior_payload_wrapper
+split_bt_behavior_payload(struct zmk_behavior_binding *binding,
+                          struct zmk_behavior_binding_event event, bool state) {
+    struct zmk_split_run_behavior_payload_wrapper wrapper = {.payload = {.data = {
+                                                                 .param1 = binding->param1,
+                                                                 .param2 = binding->param2,
+                                                                 .position = event.position,
+                                                                 .state = state ? 1 : 0,
+                                                             }}};
+    const size_t payload_dev_size = sizeof(wrapper.payload.behavior_dev);
+    if (strlcpy(wrapper.payload.behavior_dev, binding->behavior_dev, payload_dev_size) >=
         payload_dev_size) {
         LOG_ERR("Truncated behavior label %s to %s before invoking peripheral behavior",
-                binding->behavior_dev, payload.behavior_dev);
+                binding->behavior_dev, wrapper.payload.behavior_dev);
+    }
+
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_BEHAVIOR_IDS)
+    wrapper.behavior_id = zmk_split_bt_behavior_id(binding);
+#endif
+
+    return wrapper;
+}
+
+int zmk_split_bt_invoke_behavior(uint8_t source, struct zmk_behavior_binding *binding,
+                                 struct zmk_behavior_binding_event event, bool state) {
+    if (source >= ZMK_SPLIT_BLE_PERIPHERAL_COUNT) {
+        return -EINVAL;
     }
 
-    struct zmk_split_run_behavior_payload_wrapper wrapper = {.source = source, .payload = payload};
-    return split_bt_invoke_behavior_payload(wrapper);
+    LOG_DBG("");
+
+    struct zmk_split_run_behavior_payload_wrapper wrapper =
+        split_bt_behavior_payload(binding, event, state);
+
+    int err = split_bt_queue_behavior_payload(&peripherals[source], &wrapper);
+    if (err) {
+        return err;
+    }
+
+    k_work_submit_to_queue(&split_central_split_run_q, &split_central_split_run_work);
+
+    return 0;
+}
+
+int zmk_split_bt_invoke_behavior_all(struct zmk_behavior_binding *binding,
+                                     struct zmk_behavior_binding_event event, bool state) {
+    LOG_DBG("");
+
+    struct zmk_split_run_behavior_payload_wrapper wrapper =
+        split_bt_behavior_payload(binding, event, state);
+
+    int ret = 0;
+    for (int i = 0; i < ZMK_SPLIT_BLE_PERIPHERAL_COUNT; i++) {
+        if (peripherals[i].state != PERIPHERAL_SLOT_STATE_CONNECTED) {
+            continue;
+        }
+
+        // Keep going, so one peripheral failing doesn't stop the others from running the behavior.
+        int err = split_bt_queue_behavior_payload(&peripherals[i], &wrapper);
+        if (err) {
+            LOG_WRN("Failed to queue behavior for peripheral %d (%d)", i, err);
+            ret = err;
+        }
+    }
+
+    k_work_submit_to_queue(&split_central_split_run_q, &split_central_split_run_work);
+
+    return ret;
 }
 
+int zmk_split_bt_central_get_peripheral_stats(uint8_t source,
+                                              struct zmk_split_peripheral_stats *stats) {
+    if (source >= ZMK_SPLIT_BLE_PERIPHERAL_COUNT) {
+        return -EINVAL;
+    }
+
+    *stats = peripherals[source].stats;
+    stats->behavior_queue_depth = k_msgq_num_used_get(&peripherals[source].run_behavior_msgq);
+
+    return 0;
+}
+
+#if IS_ENABLED(CONFIG_SHELL)
+
+static int cmd_split_stats(const struct shell *sh, size_t argc, char **argv) {
+    shell_print(sh, "%-4s %8s %8s %8s %8s %6s %6s %8s %8s", "slot", "events", "ev drop", "behav",
+                "bh drop", "queue", "q max", "delay ms", "max ms");
+
+    for (int i = 0; i < ZMK_SPLIT_BLE_PERIPHERAL_COUNT; i++) {
+        struct zmk_split_peripheral_stats stats;
+        zmk_split_bt_central_get_peripheral_stats(i, &stats);
+
+        shell_print(sh, "%-4d %8u %8u %8u %8u %6u %6u %8u %8u", i, stats.position_events,
+                    stats.position_events_dropped, stats.behaviors_sent, stats.behaviors_dropped,
+                    stats.behavior_queue_depth, stats.behavior_queue_high_water,
+                    stats.link_delay_ms, stats.max_link_delay_ms);
+    }
+
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_split,
+                               SHELL_CMD(stats, NULL, "Show peripheral link statistics",
+                                         cmd_split_stats),
+                               SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(split, &sub_split, "Split keyboard commands", NULL);
+
+#endif /* IS_ENABLED(CONFIG_SHELL) */
+
 int zmk_split_bt_central_init(const struct device *_arg) {
+    for (int i = 0; i < ARRAY_SIZE(slot_index_by_conn); i++) {
+        slot_index_by_conn[i] = -1;
+    }
+
+    for (int i = 0; i < ZMK_SPLIT_BLE_PERIPHERAL_COUNT; i++) {
+        k_msgq_init(&peripherals[i].run_behavior_msgq, peripherals[i].run_behavior_msgq_buffer,
+                    sizeof(struct zmk_split_run_behavior_payload_wrapper),
+                    CONFIG_ZMK_SPLIT_BLE_CENTRAL_SPLIT_RUN_QUEUE_SIZE);
+    }
+
     k_work_queue_start(&split_central_split_run_q, split_central_split_run_q_stack,
                        K_THREAD_STACK_SIZEOF(split_central_split_run_q_stack),
                        CONFIG_ZMK_BLE_THREAD_PRIORITY, NULL);
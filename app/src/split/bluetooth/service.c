@@ -7,6 +7,7 @@
 #include <zephyr/drivers/sensor.h>
 #include <zephyr/types.h>
 #include <zephyr/sys/util.h>
+#include <zephyr/sys/byteorder.h>
 #include <zephyr/init.h>
 
 #include <zephyr/logging/log.h>
@@ -38,10 +39,8 @@ static void split_svc_sensor_state_ccc(const struct bt_gatt_attr *attr, uint16_t
 }
 #endif /* ZMK_KEYMAP_HAS_SENSORS */
 
-#define POS_STATE_LEN 16
-
 static uint8_t num_of_positions = ZMK_KEYMAP_LEN;
-static uint8_t position_state[POS_STATE_LEN];
+static uint8_t position_state[ZMK_SPLIT_POS_STATE_LEN];
 
 static struct zmk_split_run_behavior_payload behavior_run_payload;
 
@@ -96,6 +95,55 @@ static ssize_t split_svc_run_behavior(struct bt_conn *conn, const struct bt_gatt
     return len;
 }
 
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_BEHAVIOR_IDS)
+static ssize_t split_svc_behavior_table_hash(struct bt_conn *conn, const struct bt_gatt_attr *attrs,
+                                             void *buf, uint16_t len, uint16_t offset) {
+    const uint32_t hash = sys_cpu_to_le32(zmk_split_bt_behavior_table_hash());
+    return bt_gatt_attr_read(conn, attrs, buf, len, offset, &hash, sizeof(hash));
+}
+
+static ssize_t split_svc_run_behavior_id(struct bt_conn *conn, const struct bt_gatt_attr *attrs,
+                                         const void *buf, uint16_t len, uint16_t offset,
+                                         uint8_t flags) {
+    struct zmk_split_run_behavior_id_payload payload;
+
+    if (offset != 0 || len != sizeof(payload)) {
+        return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+    }
+
+    memcpy(&payload, buf, sizeof(payload));
+
+    const struct device *behavior = zmk_split_bt_behavior_by_id(payload.behavior_id);
+    if (behavior == NULL) {
+        LOG_ERR("No behavior with ID %d", payload.behavior_id);
+        return len;
+    }
+
+    struct zmk_behavior_binding binding = {
+        .behavior_dev = (char *)behavior->name,
+        .behavior = behavior,
+        .param1 = payload.data.param1,
+        .param2 = payload.data.param2,
+    };
+    LOG_DBG("%s with params %d %d: pressed? %d", binding.behavior_dev, binding.param1,
+            binding.param2, payload.data.state);
+    struct zmk_behavior_binding_event event = {.position = payload.data.position,
+                                               .timestamp = k_uptime_get()};
+    int err;
+    if (payload.data.state > 0) {
+        err = behavior_keymap_binding_pressed(&binding, event);
+    } else {
+        err = behavior_keymap_binding_released(&binding, event);
+    }
+
+    if (err) {
+        LOG_ERR("Failed to invoke behavior %s: %d", binding.behavior_dev, err);
+    }
+
+    return len;
+}
+#endif /* IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_BEHAVIOR_IDS) */
+
 static ssize_t split_svc_num_of_positions(struct bt_conn *conn, const struct bt_gatt_attr *attrs,
                                           void *buf, uint16_t len, uint16_t offset) {
     return bt_gatt_attr_read(conn, attrs, buf, len, offset, attrs->user_data, sizeof(uint8_t));
@@ -105,6 +153,15 @@ static void split_svc_pos_state_ccc(const struct bt_gatt_attr *attr, uint16_t va
     LOG_DBG("value %d", value);
 }
 
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_POSITION_CHANGES)
+static bool position_changes_subscribed;
+
+static void split_svc_pos_changes_ccc(const struct bt_gatt_attr *attr, uint16_t value) {
+    LOG_DBG("value %d", value);
+    position_changes_subscribed = (value == BT_GATT_CCC_NOTIFY);
+}
+#endif /* IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_POSITION_CHANGES) */
+
 BT_GATT_SERVICE_DEFINE(
     split_svc, BT_GATT_PRIMARY_SERVICE(BT_UUID_DECLARE_128(ZMK_SPLIT_BT_SERVICE_UUID)),
     BT_GATT_CHARACTERISTIC(BT_UUID_DECLARE_128(ZMK_SPLIT_BT_CHAR_POSITION_STATE_UUID),
@@ -122,17 +179,29 @@ BT_GATT_SERVICE_DEFINE(
                            split_svc_sensor_state, NULL, &last_sensor_event),
     BT_GATT_CCC(split_svc_sensor_state_ccc, BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT),
 #endif /* ZMK_KEYMAP_HAS_SENSORS */
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_BEHAVIOR_IDS)
+    // Reading gives the hash of the behavior ID table, so the central can check it matches its own.
+    BT_GATT_CHARACTERISTIC(BT_UUID_DECLARE_128(ZMK_SPLIT_BT_CHAR_RUN_BEHAVIOR_ID_UUID),
+                           BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE_WITHOUT_RESP,
+                           BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT,
+                           split_svc_behavior_table_hash, split_svc_run_behavior_id, NULL),
+#endif /* IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_BEHAVIOR_IDS) */
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_POSITION_CHANGES)
+    BT_GATT_CHARACTERISTIC(BT_UUID_DECLARE_128(ZMK_SPLIT_BT_CHAR_POSITION_CHANGES_UUID),
+                           BT_GATT_CHRC_NOTIFY, BT_GATT_PERM_READ_ENCRYPT, NULL, NULL, NULL),
+    BT_GATT_CCC(split_svc_pos_changes_ccc, BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT),
+#endif /* IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_POSITION_CHANGES) */
 );
 
 K_THREAD_STACK_DEFINE(service_q_stack, CONFIG_ZMK_SPLIT_BLE_PERIPHERAL_STACK_SIZE);
 
 struct k_work_q service_work_q;
 
-K_MSGQ_DEFINE(position_state_msgq, sizeof(char[POS_STATE_LEN]),
+K_MSGQ_DEFINE(position_state_msgq, sizeof(char[ZMK_SPLIT_POS_STATE_LEN]),
               CONFIG_ZMK_SPLIT_BLE_PERIPHERAL_POSITION_QUEUE_SIZE, 4);
 
 void send_position_state_callback(struct k_work *work) {
-    uint8_t state[POS_STATE_LEN];
+    uint8_t state[ZMK_SPLIT_POS_STATE_LEN];
 
     while (k_msgq_get(&position_state_msgq, &state, K_NO_WAIT) == 0) {
         int err = bt_gatt_notify(NULL, &split_svc.attrs[1], &state, sizeof(state));
@@ -150,7 +219,7 @@ int send_position_state() {
         switch (err) {
         case -EAGAIN: {
             LOG_WRN("Position state message queue full, popping first message and queueing again");
-            uint8_t discarded_state[POS_STATE_LEN];
+            uint8_t discarded_state[ZMK_SPLIT_POS_STATE_LEN];
             k_msgq_get(&position_state_msgq, &discarded_state, K_NO_WAIT);
             return send_position_state();
         }
@@ -165,16 +234,207 @@ int send_position_state() {
     return 0;
 }
 
-int zmk_split_bt_position_pressed(uint8_t position) {
-    WRITE_BIT(position_state[position / 8], position % 8, true);
-    return send_position_state();
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_POSITION_CHANGES)
+
+#define POSITION_CHANGES_MAX_BATCH 16
+
+struct position_change {
+    int64_t timestamp;
+    uint16_t position;
+    bool pressed;
+};
+
+struct position_changes_notification {
+    struct zmk_split_position_changes_header header;
+    struct zmk_split_position_change changes[POSITION_CHANGES_MAX_BATCH];
+} __packed;
+
+K_MSGQ_DEFINE(position_change_msgq, sizeof(struct position_change),
+              CONFIG_ZMK_SPLIT_BLE_PERIPHERAL_POSITION_QUEUE_SIZE, 4);
+
+// Changes which didn't fit in the queue. Unlike full states, a change can't just be dropped, so
+// once the queue overflows, every change is counted here per position until all of them have been
+// sent, which keeps them behind the changes already queued. A position which changed more than
+// once is sent as a press and a release, plus the final change if the count was odd, so none of
+// its presses or releases are lost, though changes to different positions are sent in position
+// order rather than the order they happened in.
+static struct k_spinlock overflow_lock;
+static bool overflowing;
+static uint8_t overflow_state[ZMK_SPLIT_POS_STATE_LEN];
+// Whether each position has an odd number of changes left to send.
+static uint8_t overflow_odd[ZMK_SPLIT_POS_STATE_LEN];
+// Whether each position has two or more changes left to send.
+static uint8_t overflow_repeated[ZMK_SPLIT_POS_STATE_LEN];
+// Overflowed changes are all sent with the time of the most recent one.
+static int64_t overflow_timestamp;
+
+static const struct bt_gatt_attr *position_changes_attr;
+
+static bool position_bit(const uint8_t *bits, uint16_t position) {
+    return bits[position / 8] & BIT(position % 8);
+}
+
+static void overflow_position_change(uint16_t position, bool pressed, int64_t timestamp) {
+    if (position_bit(overflow_odd, position) || position_bit(overflow_repeated, position)) {
+        WRITE_BIT(overflow_repeated[position / 8], position % 8, true);
+    }
+
+    overflow_odd[position / 8] ^= BIT(position % 8);
+    WRITE_BIT(overflow_state[position / 8], position % 8, pressed);
+    overflow_timestamp = timestamp;
+}
+
+static bool next_overflowed_change(struct position_change *change) {
+    for (uint16_t position = 0; position < ZMK_SPLIT_POS_STATE_LEN * 8; position++) {
+        bool odd = position_bit(overflow_odd, position);
+        bool repeated = position_bit(overflow_repeated, position);
+        if (!odd && !repeated) {
+            continue;
+        }
+
+        // The state the central has seen is the current one if an even number of changes is left.
+        bool sent_state = position_bit(overflow_state, position) != odd;
+
+        *change = (struct position_change){
+            .timestamp = overflow_timestamp,
+            .position = position,
+            .pressed = !sent_state,
+        };
+
+        // Two changes left leaves one. Three or more leaves at least two, which is counted the
+        // same as two.
+        if (!odd) {
+            WRITE_BIT(overflow_repeated[position / 8], position % 8, false);
+        }
+        overflow_odd[position / 8] ^= BIT(position % 8);
+
+        return true;
+    }
+
+    overflowing = false;
+    return false;
+}
+
+static bool next_position_change(struct position_change *change) {
+    if (k_msgq_get(&position_change_msgq, change, K_NO_WAIT) == 0) {
+        return true;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&overflow_lock);
+    bool found = overflowing && next_overflowed_change(change);
+    k_spin_unlock(&overflow_lock, key);
+
+    return found;
+}
+
+static void min_mtu_cb(struct bt_conn *conn, void *data) {
+    uint16_t *mtu = data;
+    *mtu = MIN(*mtu, bt_gatt_get_mtu(conn));
+}
+
+static size_t position_changes_batch_size() {
+    uint16_t mtu = UINT16_MAX;
+    bt_conn_foreach(BT_CONN_TYPE_LE, min_mtu_cb, &mtu);
+
+    // 3 bytes of the MTU are taken by the ATT header of the notification.
+    const size_t max_changes = (mtu - 3 - sizeof(struct zmk_split_position_changes_header)) /
+                               sizeof(struct zmk_split_position_change);
+
+    return CLAMP(max_changes, 1, POSITION_CHANGES_MAX_BATCH);
+}
+
+void send_position_changes_callback(struct k_work *work) {
+    const size_t batch_size = position_changes_batch_size();
+    struct position_change changes[POSITION_CHANGES_MAX_BATCH];
+    size_t count;
+
+    do {
+        for (count = 0; count < batch_size; count++) {
+            if (!next_position_change(&changes[count])) {
+                break;
+            }
+        }
+
+        if (count == 0) {
+            break;
+        }
+
+        int64_t newest = changes[0].timestamp;
+        for (int i = 1; i < count; i++) {
+            newest = MAX(newest, changes[i].timestamp);
+        }
+
+        struct position_changes_notification notification = {
+            .header = {.timestamp = (uint32_t)newest},
+        };
+
+        for (int i = 0; i < count; i++) {
+            notification.changes[i] = (struct zmk_split_position_change){
+                .position = changes[i].position |
+                            (changes[i].pressed ? ZMK_SPLIT_POSITION_CHANGE_PRESSED : 0),
+                .age = MIN(newest - changes[i].timestamp, UINT16_MAX),
+            };
+        }
+
+        const size_t len = sizeof(notification.header) + count * sizeof(notification.changes[0]);
+        int err = bt_gatt_notify(NULL, position_changes_attr, &notification, len);
+        if (err) {
+            LOG_DBG("Error notifying %d", err);
+        }
+    } while (count == batch_size);
+}
+
+K_WORK_DEFINE(service_position_changes_notify_work, send_position_changes_callback);
+
+static int send_position_change(uint16_t position, bool pressed, int64_t timestamp) {
+    struct position_change change = {
+        .timestamp = timestamp,
+        .position = position,
+        .pressed = pressed,
+    };
+
+    k_spinlock_key_t key = k_spin_lock(&overflow_lock);
+    if (!overflowing && k_msgq_put(&position_change_msgq, &change, K_NO_WAIT) != 0) {
+        LOG_WRN("Position change queue full, sending changes once it drains");
+        overflowing = true;
+    }
+    if (overflowing) {
+        overflow_position_change(position, pressed, timestamp);
+    }
+    k_spin_unlock(&overflow_lock, key);
+
+    k_work_submit_to_queue(&service_work_q, &service_position_changes_notify_work);
+
+    return 0;
 }
 
-int zmk_split_bt_position_released(uint8_t position) {
-    WRITE_BIT(position_state[position / 8], position % 8, false);
+#endif /* IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_POSITION_CHANGES) */
+
+static int position_state_changed(uint32_t position, bool pressed, int64_t timestamp) {
+    if (position >= ZMK_SPLIT_POS_STATE_LEN * 8) {
+        LOG_ERR("Position %d is out of range", position);
+        return -EINVAL;
+    }
+
+    WRITE_BIT(position_state[position / 8], position % 8, pressed);
+
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_POSITION_CHANGES)
+    if (position_changes_subscribed) {
+        return send_position_change(position, pressed, timestamp);
+    }
+#endif
+
     return send_position_state();
 }
 
+int zmk_split_bt_position_pressed(uint32_t position, int64_t timestamp) {
+    return position_state_changed(position, true, timestamp);
+}
+
+int zmk_split_bt_position_released(uint32_t position, int64_t timestamp) {
+    return position_state_changed(position, false, timestamp);
+}
+
 #if ZMK_KEYMAP_HAS_SENSORS
 K_MSGQ_DEFINE(sensor_state_msgq, sizeof(struct sensor_event),
               CONFIG_ZMK_SPLIT_BLE_PERIPHERAL_POSITION_QUEUE_SIZE, 4);
@@ -233,6 +493,12 @@ int service_init(const struct device *_arg) {
     k_work_queue_start(&service_work_q, service_q_stack, K_THREAD_STACK_SIZEOF(service_q_stack),
                        CONFIG_ZMK_SPLIT_BLE_PERIPHERAL_PRIORITY, &queue_config);
 
+#if IS_ENABLED(CONFIG_ZMK_SPLIT_BLE_POSITION_CHANGES)
+    position_changes_attr =
+        bt_gatt_find_by_uuid(split_svc.attrs, split_svc.attr_count,
+                             BT_UUID_DECLARE_128(ZMK_SPLIT_BT_CHAR_POSITION_CHANGES_UUID));
+#endif
+
     return 0;
 }
 
@@ -4,29 +4,238 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <string.h>
+
 #include <zephyr/device.h>
 #include <zephyr/init.h>
 
+#include <zephyr/drivers/usb/usb_dc.h>
 #include <zephyr/usb/usb_device.h>
 #include <zephyr/usb/class/usb_hid.h>
 
+#if IS_ENABLED(CONFIG_SHELL)
+#include <zephyr/shell/shell.h>
+#endif
+
 #include <zmk/usb.h>
+#include <zmk/usb_hid.h>
 #include <zmk/hid.h>
 #include <zmk/keymap.h>
+#include <zmk/latency.h>
 #include <zmk/event_manager.h>
 
 LOG_MODULE_DECLARE(zmk, CONFIG_ZMK_LOG_LEVEL);
 
+// Keyboard and consumer reports, with report IDs 1 and 2.
+#define REPORT_ID_COUNT 2
+#define MAX_REPORT_LEN                                                                             \
+    MAX(sizeof(struct zmk_hid_keyboard_report), sizeof(struct zmk_hid_consumer_report))
+#define REPORT_QUEUE_SIZE CONFIG_ZMK_USB_HID_REPORT_QUEUE_SIZE
+
+// A report which the host hasn't read within this time was most likely lost, for example because
+// the host stopped polling, so the write is cancelled and the report written again.
+#define STALL_TIMEOUT_MS 30
+
+// How long to wait before writing a report again after the endpoint failed to accept it.
+#define WRITE_RETRY_MS 1
+
+struct pending_report {
+    // Order in which reports were queued, across all report IDs.
+    uint32_t seq;
+    uint32_t trace_start;
+    uint8_t len;
+    uint8_t data[MAX_REPORT_LEN];
+};
+
+// Reports stay queued until the host has read them, so one which fails to be written or is never
+// read is written again rather than lost.
+struct report_queue {
+    struct pending_report reports[REPORT_QUEUE_SIZE];
+    uint8_t head;
+    uint8_t len;
+};
+
+#define REPORT_QUEUE_AT(queue, i) (&(queue)->reports[((queue)->head + (i)) % REPORT_QUEUE_SIZE])
+
 static const struct device *hid_dev;
 
-static K_SEM_DEFINE(hid_sem, 1, 1);
+static struct k_spinlock lock;
+static struct report_queue report_queues[REPORT_ID_COUNT];
+static uint32_t next_seq;
+
+// Copy of the report currently being written to the endpoint, valid while ep_busy is set. The
+// report itself stays at the head of its queue until the host reads it.
+static struct pending_report in_flight;
+static bool ep_busy;
+static int64_t ep_busy_since;
+
+static struct zmk_usb_hid_stats stats;
+
+static void endpoint_work_handler(struct k_work *work);
+
+// Retries failed writes, and cancels writes which the host hasn't read within the stall timeout.
+static K_WORK_DELAYABLE_DEFINE(endpoint_work, endpoint_work_handler);
+
+// The queue with the oldest pending report of any report ID, so the host sees reports in order.
+static struct report_queue *next_report_queue() {
+    struct report_queue *next = NULL;
+
+    for (int i = 0; i < REPORT_ID_COUNT; i++) {
+        struct report_queue *queue = &report_queues[i];
+        if (queue->len == 0) {
+            continue;
+        }
+
+        if (next == NULL ||
+            (int32_t)(REPORT_QUEUE_AT(queue, 0)->seq - REPORT_QUEUE_AT(next, 0)->seq) < 0) {
+            next = queue;
+        }
+    }
+
+    return next;
+}
+
+// The HID class's interrupt IN endpoint, which is the first endpoint of its configuration.
+static uint8_t in_ep_addr() {
+    const struct usb_cfg_data *cfg = hid_dev->config;
+    return cfg->endpoint[0].ep_addr;
+}
+
+static void send_next_report() {
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    struct report_queue *queue = next_report_queue();
+    if (ep_busy || queue == NULL) {
+        k_spin_unlock(&lock, key);
+        return;
+    }
+
+    in_flight = *REPORT_QUEUE_AT(queue, 0);
+    ep_busy = true;
+    ep_busy_since = k_uptime_get();
+
+    k_spin_unlock(&lock, key);
+
+    int err = hid_int_ep_write(hid_dev, in_flight.data, in_flight.len, NULL);
+    if (err) {
+        LOG_ERR("Failed to write report to the endpoint (err %d)", err);
+
+        key = k_spin_lock(&lock);
+        ep_busy = false;
+        stats.errors++;
+        k_spin_unlock(&lock, key);
+
+        // The report is still queued, so write it again shortly.
+        k_work_reschedule(&endpoint_work, K_MSEC(WRITE_RETRY_MS));
+        return;
+    }
+
+    k_work_reschedule(&endpoint_work, K_MSEC(STALL_TIMEOUT_MS));
+}
+
+static void in_ready_cb(const struct device *dev) {
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    const bool was_busy = ep_busy;
+    const uint32_t trace_start = in_flight.trace_start;
+
+    if (was_busy) {
+        struct report_queue *queue = &report_queues[in_flight.data[0] - 1];
+
+        // A report replaced by a newer one while it was being written stays queued, since the
+        // host hasn't seen the newer one yet.
+        if (queue->len > 0 && REPORT_QUEUE_AT(queue, 0)->seq == in_flight.seq) {
+            queue->head = (queue->head + 1) % REPORT_QUEUE_SIZE;
+            queue->len--;
+        }
+
+        ep_busy = false;
+        stats.sent++;
+    }
+
+    k_spin_unlock(&lock, key);
 
-static void in_ready_cb(const struct device *dev) { k_sem_give(&hid_sem); }
+    if (was_busy) {
+        zmk_latency_record_from(ZMK_LATENCY_STAGE_REPORT_SENT, trace_start);
+    }
+
+    // The endpoint was just freed, so writing the next report won't wait.
+    send_next_report();
+}
+
+static void endpoint_work_handler(struct k_work *work) {
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    const bool stalled = ep_busy && (k_uptime_get() - ep_busy_since >= STALL_TIMEOUT_MS);
+    const uint32_t stalled_seq = in_flight.seq;
+    k_spin_unlock(&lock, key);
+
+    if (stalled) {
+        // Cancel the write before the endpoint is reused, so a late completion of it can't be
+        // taken for the next write. If the host reads it in the meantime, it isn't stalled.
+        usb_dc_ep_flush(in_ep_addr());
+
+        key = k_spin_lock(&lock);
+        const bool still_stalled = ep_busy && in_flight.seq == stalled_seq;
+        if (still_stalled) {
+            ep_busy = false;
+            stats.stalls++;
+        }
+        k_spin_unlock(&lock, key);
+
+        if (still_stalled) {
+            LOG_WRN("Host hasn't read the last report, writing it again");
+        }
+    }
+
+    send_next_report();
+}
 
 static const struct hid_ops ops = {
     .int_in_ready = in_ready_cb,
 };
 
+static int queue_report(const uint8_t *report, size_t len) {
+    if (len == 0 || len > MAX_REPORT_LEN || report[0] == 0 || report[0] > REPORT_ID_COUNT) {
+        return -EINVAL;
+    }
+
+    struct report_queue *queue = &report_queues[report[0] - 1];
+    struct pending_report *pending;
+
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    if (queue->len < REPORT_QUEUE_SIZE) {
+        pending = REPORT_QUEUE_AT(queue, queue->len);
+        queue->len++;
+    } else {
+        // The new state supersedes the newest unread one instead of waiting for space.
+        pending = REPORT_QUEUE_AT(queue, queue->len - 1);
+        stats.overflows++;
+    }
+
+    pending->seq = next_seq++;
+    pending->trace_start = zmk_latency_trace_start();
+    pending->len = len;
+    memcpy(pending->data, report, len);
+
+    k_spin_unlock(&lock, key);
+
+    return 0;
+}
+
+static void clear_reports() {
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    for (int i = 0; i < REPORT_ID_COUNT; i++) {
+        report_queues[i].len = 0;
+    }
+    ep_busy = false;
+
+    k_spin_unlock(&lock, key);
+
+    k_work_cancel_delayable(&endpoint_work);
+}
+
 int zmk_usb_hid_send_report(const uint8_t *report, size_t len) {
     switch (zmk_usb_get_status()) {
     case USB_DC_SUSPEND:
@@ -35,19 +244,47 @@ int zmk_usb_hid_send_report(const uint8_t *report, size_t len) {
     case USB_DC_RESET:
     case USB_DC_DISCONNECTED:
     case USB_DC_UNKNOWN:
+        clear_reports();
         return -ENODEV;
-    default:
-        k_sem_take(&hid_sem, K_MSEC(30));
-        int err = hid_int_ep_write(hid_dev, report, len, NULL);
-
+    default: {
+        int err = queue_report(report, len);
         if (err) {
-            k_sem_give(&hid_sem);
+            return err;
         }
 
-        return err;
+        send_next_report();
+        return 0;
+    }
     }
 }
 
+void zmk_usb_hid_get_stats(struct zmk_usb_hid_stats *result) {
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    *result = stats;
+    k_spin_unlock(&lock, key);
+}
+
+#if IS_ENABLED(CONFIG_SHELL)
+
+static int cmd_usb_stats(const struct shell *sh, size_t argc, char **argv) {
+    struct zmk_usb_hid_stats stats;
+    zmk_usb_hid_get_stats(&stats);
+
+    shell_print(sh, "sent %u, overflows %u, stalls %u, errors %u", stats.sent, stats.overflows,
+                stats.stalls, stats.errors);
+
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_usb,
+                               SHELL_CMD(stats, NULL, "Show USB HID report statistics",
+                                         cmd_usb_stats),
+                               SHELL_SUBCMD_SET_END);
+
+SHELL_CMD_REGISTER(usb, &sub_usb, "USB commands", NULL);
+
+#endif /* IS_ENABLED(CONFIG_SHELL) */
+
 static int zmk_usb_hid_init(const struct device *_arg) {
     hid_dev = device_get_binding("HID_0");
     if (hid_dev == NULL) {